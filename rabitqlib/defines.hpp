@@ -64,4 +64,13 @@ struct AnnCandidate {
 
 enum MetricType : std::uint8_t { METRIC_L2, METRIC_IP };
 enum ScalarQuantizerType : std::uint8_t {RECONSTRUCTION, UNBIASED_ESTIMATION, PLAIN};
+
+// layout of ex codes, kPacked: codes are packed by packing_rabitqplus_code(), kBitPlane:
+// codes are stored as ex_bits bit planes (the most significant plane first)
+enum class ExCodeLayout : std::uint8_t { kPacked, kBitPlane };
+
+// storage type of the factors of 1-bit batches, kFp16/kBf16 halve the bytes of factors and
+// widen lower bounds by their rounding error. fp16 only covers factors up to 65504, IVF
+// falls back to kFp32 otherwise.
+enum class FactorType : std::uint8_t { kFp32, kFp16, kBf16 };
 }  // namespace rabitqlib
\ No newline at end of file
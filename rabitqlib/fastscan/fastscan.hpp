@@ -5,12 +5,14 @@
 
 #include <immintrin.h>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <type_traits>
 
 #include "defines.hpp"
 
@@ -105,6 +107,61 @@ inline void pack_codes(
     }
 }
 
+// position of vector (id % 16) in each 16-byte row of packed codes, inverse of kPerm0
+constexpr static std::array<uint8_t, 16> kInvPerm0 = [] {
+    std::array<uint8_t, 16> inv{};
+    for (size_t j = 0; j < 16; ++j) {
+        inv[kPerm0[j]] = static_cast<uint8_t>(j);
+    }
+    return inv;
+}();
+
+/**
+ * @brief Pack the col-th byte (8 dims) of the quantization code of the id-th vector in a
+ * batch into block, same layout as pack_codes(). Codes can thus be packed while they are
+ * computed, without buffering the codes of the whole batch. block must be zeroed first.
+ */
+inline void pack_code_byte(uint8_t code, size_t col, size_t id, uint8_t* block) {
+    uint8_t* dst = block + (col * kBatchSize) + kInvPerm0[id % 16];
+    unsigned shift = id < 16 ? 0 : 4;
+    dst[0] |= static_cast<uint8_t>((code >> 4) << shift);  // upper 4 bits
+    dst[16] |= static_cast<uint8_t>((code & 15) << shift);  // lower 4 bits
+}
+
+#if defined(__AVX512F__)
+namespace accumulate_impl {
+// sum up the accumulators of a batch in accumulate() and store the results of 32 vectors
+inline void reduce_store(
+    __m512i accu0, __m512i accu1, __m512i accu2, __m512i accu3, uint16_t* result
+) {
+    // remove the influence of upper 8 bits for accu0 and accu2
+    accu0 = _mm512_sub_epi16(accu0, _mm512_slli_epi16(accu1, 8));
+    accu2 = _mm512_sub_epi16(accu2, _mm512_slli_epi16(accu3, 8));
+
+    // At this point, we already have the correct accumulating result (accu0: 8-15, accu1:
+    // 0-7, accu2: 16-23, accu3: 24-31), but we still need to write them back to RAM. Also,
+    // each accu contains 4 lines of __m128i and we need to sum them together to get the
+    // final results. 512/16=32, so we can use one __m512i to contain all results. The
+    // following codes are designed for this purpose. For detailed information, please check
+    // the SIMD documentation.
+    __m512i ret1 = _mm512_add_epi16(
+        _mm512_mask_blend_epi64(0b11110000, accu0, accu1),
+        _mm512_shuffle_i64x2(accu0, accu1, 0b01001110)
+    );
+    __m512i ret2 = _mm512_add_epi16(
+        _mm512_mask_blend_epi64(0b11110000, accu2, accu3),
+        _mm512_shuffle_i64x2(accu2, accu3, 0b01001110)
+    );
+    __m512i ret = _mm512_setzero_si512();
+
+    ret = _mm512_add_epi16(ret, _mm512_shuffle_i64x2(ret1, ret2, 0b10001000));
+    ret = _mm512_add_epi16(ret, _mm512_shuffle_i64x2(ret1, ret2, 0b11011101));
+    // 存储32个结果
+    _mm512_storeu_si512(result, ret);
+}
+}  // namespace accumulate_impl
+#endif
+
 // use fast scan to accumulate one block, dim % 16 == 0
 inline void accumulate(
     const uint8_t* __restrict__ codes,
@@ -149,30 +206,7 @@ inline void accumulate(
         accu2 = _mm512_add_epi16(accu2, res_hi);
         accu3 = _mm512_add_epi16(accu3, _mm512_srli_epi16(res_hi, 8));
     }
-    // remove the influence of upper 8 bits for accu0 and accu2
-    accu0 = _mm512_sub_epi16(accu0, _mm512_slli_epi16(accu1, 8));
-    accu2 = _mm512_sub_epi16(accu2, _mm512_slli_epi16(accu3, 8));
-
-    // At this point, we already have the correct accumulating result (accu0: 8-15, accu1:
-    // 0-7, accu2: 16-23, accu3: 24-31), but we still need to write them back to RAM. Also,
-    // each accu contains 4 lines of __m128i and we need to sum them together to get the
-    // final results. 512/16=32, so we can use one __m512i to contain all results. The
-    // following codes are designed for this purpose. For detailed information, please check
-    // the SIMD documentation.
-    __m512i ret1 = _mm512_add_epi16(
-        _mm512_mask_blend_epi64(0b11110000, accu0, accu1),
-        _mm512_shuffle_i64x2(accu0, accu1, 0b01001110)
-    );
-    __m512i ret2 = _mm512_add_epi16(
-        _mm512_mask_blend_epi64(0b11110000, accu2, accu3),
-        _mm512_shuffle_i64x2(accu2, accu3, 0b01001110)
-    );
-    __m512i ret = _mm512_setzero_si512();
-
-    ret = _mm512_add_epi16(ret, _mm512_shuffle_i64x2(ret1, ret2, 0b10001000));
-    ret = _mm512_add_epi16(ret, _mm512_shuffle_i64x2(ret1, ret2, 0b11011101));
-    // 存储32个结果
-    _mm512_storeu_si512(result, ret);
+    accumulate_impl::reduce_store(accu0, accu1, accu2, accu3, result);
 
 #elif defined(__AVX2__)
     __m256i c, lo, hi, lut, res_lo, res_hi;
@@ -230,6 +264,52 @@ inline void accumulate(
 #endif
 }
 
+/**
+ * @brief accumulate() for two batches (64 vectors) with the same lut, each part of the lut
+ * is loaded once for both batches. result[0, 32) for codes0 and result[32, 64) for codes1.
+ */
+inline void accumulate_x2(
+    const uint8_t* __restrict__ codes0,
+    const uint8_t* __restrict__ codes1,
+    const uint8_t* __restrict__ lp_table,
+    uint16_t* __restrict__ result,
+    size_t dim
+) {
+#if defined(__AVX512F__)
+    size_t code_length = dim << 2;
+    const __m512i lo_mask = _mm512_set1_epi8(0x0f);
+    __m512i accu_b0[4];  // for codes0, same as accu0-3 in accumulate()
+    __m512i accu_b1[4];  // for codes1
+    for (size_t i = 0; i < 4; ++i) {
+        accu_b0[i] = _mm512_setzero_si512();
+        accu_b1[i] = _mm512_setzero_si512();
+    }
+
+    auto add = [&lo_mask](__m512i* accu, __m512i lut, __m512i c) {
+        __m512i res_lo = _mm512_shuffle_epi8(lut, _mm512_and_si512(c, lo_mask));
+        __m512i res_hi =
+            _mm512_shuffle_epi8(lut, _mm512_and_si512(_mm512_srli_epi16(c, 4), lo_mask));
+        accu[0] = _mm512_add_epi16(accu[0], res_lo);
+        accu[1] = _mm512_add_epi16(accu[1], _mm512_srli_epi16(res_lo, 8));
+        accu[2] = _mm512_add_epi16(accu[2], res_hi);
+        accu[3] = _mm512_add_epi16(accu[3], _mm512_srli_epi16(res_hi, 8));
+    };
+
+    for (size_t i = 0; i < code_length; i += 64) {
+        __m512i lut = _mm512_loadu_si512(&lp_table[i]);
+        add(accu_b0, lut, _mm512_loadu_si512(&codes0[i]));
+        add(accu_b1, lut, _mm512_loadu_si512(&codes1[i]));
+    }
+    accumulate_impl::reduce_store(accu_b0[0], accu_b0[1], accu_b0[2], accu_b0[3], result);
+    accumulate_impl::reduce_store(
+        accu_b1[0], accu_b1[1], accu_b1[2], accu_b1[3], result + kBatchSize
+    );
+#else
+    accumulate(codes0, lp_table, result, dim);
+    accumulate(codes1, lp_table, result + kBatchSize, dim);
+#endif
+}
+
 // pack lookup table for fastscan, for each 4 dim, we have 16 (2^4) different results
 // ! dim % 4 == 0
 template <typename T>
@@ -244,4 +324,49 @@ inline void pack_lut(size_t dim, const T* __restrict__ query, T* __restrict__ lu
         query += 4;
     }
 }
+
+/**
+ * @brief pack_lut() that also finds the range [lo, hi] of the lut, saving a separate pass
+ * over the lut. Entry j of a codebook is the sum of query[3 - b] for all bits b set in j.
+ */
+template <typename T>
+inline void pack_lut_range(
+    size_t dim, const T* __restrict__ query, T* __restrict__ lut, T& lo, T& hi
+) {
+    size_t num_codebook = dim >> 2;
+#if defined(__AVX512F__)
+    if constexpr (std::is_same_v<T, float>) {
+        constexpr std::array<__mmask16, 4> kBitMask = {0xAAAA, 0xCCCC, 0xF0F0, 0xFF00};
+        __m512 vlo = _mm512_setzero_ps();  // lut[0] = 0 for all codebooks
+        __m512 vhi = _mm512_setzero_ps();
+        for (size_t i = 0; i < num_codebook; ++i) {
+            __m512 entry = _mm512_setzero_ps();
+            for (size_t b = 0; b < 4; ++b) {
+                entry =
+                    _mm512_mask_add_ps(entry, kBitMask[b], entry, _mm512_set1_ps(query[3 - b]));
+            }
+            _mm512_storeu_ps(lut, entry);
+            vlo = _mm512_min_ps(vlo, entry);
+            vhi = _mm512_max_ps(vhi, entry);
+            lut += 16;
+            query += 4;
+        }
+        lo = _mm512_reduce_min_ps(vlo);
+        hi = _mm512_reduce_max_ps(vhi);
+        return;
+    }
+#endif
+    lo = 0;
+    hi = 0;
+    for (size_t i = 0; i < num_codebook; ++i) {
+        lut[0] = 0;
+        for (size_t j = 1; j < 16; ++j) {
+            lut[j] = lut[j - LOWBIT(j)] + query[kPos[j]];
+            lo = std::min(lo, lut[j]);
+            hi = std::max(hi, lut[j]);
+        }
+        lut += 16;
+        query += 4;
+    }
+}
 }  // namespace rabitqlib::fastscan
\ No newline at end of file
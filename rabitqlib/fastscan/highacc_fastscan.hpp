@@ -3,6 +3,7 @@
 #include <immintrin.h>
 
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -58,52 +59,53 @@ inline void transfer_lut_hacc(const uint16_t* lut, size_t dim, uint8_t* hc_lut)
     }
 }
 
-inline void accumulate_hacc(
-    const uint8_t* __restrict__ codes,
-    const uint8_t* __restrict__ hc_lut,
-    int32_t* accu_res,
-    size_t dim
+/**
+ * @brief Quantize a float lookup table (pack_lut()) into u16 by lo and delta, and split it
+ * into two sub luts as transfer_lut_hacc(), without an intermediate u16 table.
+ **/
+inline void quantize_lut_hacc(
+    const float* lut, size_t dim, float lo, float delta, uint8_t* hc_lut
 ) {
-#if defined(USE_EXPLICIT_SIMD)
-    __m512i low_mask = _mm512_set1_epi8(0xf);
-    __m512i accu[2][4];
-
-    for (auto& a : accu) {
-        for (auto& reg : a) {
-            reg = _mm512_setzero_si512();
-        }
-    }
-
     size_t num_codebook = dim >> 2;
+    float one_over_delta = 1 / delta;
 
-    // std::cerr << "FastScan YES!" << std::endl;
-    for (size_t m = 0; m < num_codebook; m += 4) {
-        __m512i c = _mm512_loadu_si512(codes);
-        __m512i lo = _mm512_and_si512(c, low_mask);
-        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(c, 4), low_mask);
-
-        // accumulate lower & upper results respectively
-        // accu[0][0-3] for lower 8-bit result
-        // accu[1][0-3] for upper 8-bit result
-        for (auto& i : accu) {
-            __m512i lut = _mm512_loadu_si512(hc_lut);
-
-            __m512i res_lo = _mm512_shuffle_epi8(lut, lo);
-            __m512i res_hi = _mm512_shuffle_epi8(lut, hi);
+    for (size_t i = 0; i < num_codebook; i++) {
+        constexpr size_t kLaneBits = 128;
+        constexpr size_t kByteBits = 8;
 
-            i[0] = _mm512_add_epi16(i[0], res_lo);
-            i[1] = _mm512_add_epi16(i[1], _mm512_srli_epi16(res_lo, 8));
+        constexpr size_t kLutPerIter = kRegBits / kLaneBits;
+        constexpr size_t kCodePerIter = 2 * kRegBits / kByteBits;
+        constexpr size_t kCodePerLine = kLaneBits / kByteBits;
 
-            i[2] = _mm512_add_epi16(i[2], res_hi);
-            i[3] = _mm512_add_epi16(i[3], _mm512_srli_epi16(res_hi, 8));
+        uint8_t* fill_lo =
+            hc_lut + (i / kLutPerIter * kCodePerIter) + ((i % kLutPerIter) * kCodePerLine);
+        uint8_t* fill_hi = fill_lo + (kRegBits / kByteBits);
 
-            hc_lut += 64;
+#if defined(USE_EXPLICIT_SIMD)
+        __m512 cur = _mm512_mul_ps(
+            _mm512_sub_ps(_mm512_loadu_ps(lut), _mm512_set1_ps(lo)),
+            _mm512_set1_ps(one_over_delta)
+        );
+        __m512i tmp = _mm512_cvtps_epi32(cur);
+        __m128i lo8 = _mm512_cvtepi32_epi8(tmp);
+        __m128i hi8 = _mm512_cvtepi32_epi8(_mm512_srli_epi32(tmp, 8));
+        _mm_store_si128(reinterpret_cast<__m128i*>(fill_lo), lo8);
+        _mm_store_si128(reinterpret_cast<__m128i*>(fill_hi), hi8);
+#else
+        for (size_t j = 0; j < 16; ++j) {
+            int tmp = static_cast<int>(std::round((lut[j] - lo) * one_over_delta));
+            fill_lo[j] = static_cast<uint8_t>(tmp);
+            fill_hi[j] = static_cast<uint8_t>(tmp >> 8);
         }
-        codes += 64;
+#endif
+        lut += 16;
     }
+}
 
-    // std::cerr << "FastScan YES!" << std::endl;
-
+#if defined(USE_EXPLICIT_SIMD)
+namespace hacc_impl {
+// sum up the accumulators of a batch in accumulate_hacc() and store results of 32 vectors
+inline void reduce_store(const __m512i (&accu)[2][4], int32_t* accu_res) {
     __m512i res[2];
     __m512i dis0[2];
     __m512i dis1[2];
@@ -143,6 +145,55 @@ inline void accumulate_hacc(
 
     _mm512_storeu_epi32(accu_res, res[0]);
     _mm512_storeu_epi32(accu_res + 16, res[1]);
+}
+}  // namespace hacc_impl
+#endif
+
+inline void accumulate_hacc(
+    const uint8_t* __restrict__ codes,
+    const uint8_t* __restrict__ hc_lut,
+    int32_t* accu_res,
+    size_t dim
+) {
+#if defined(USE_EXPLICIT_SIMD)
+    __m512i low_mask = _mm512_set1_epi8(0xf);
+    __m512i accu[2][4];
+
+    for (auto& a : accu) {
+        for (auto& reg : a) {
+            reg = _mm512_setzero_si512();
+        }
+    }
+
+    size_t num_codebook = dim >> 2;
+
+    // std::cerr << "FastScan YES!" << std::endl;
+    for (size_t m = 0; m < num_codebook; m += 4) {
+        __m512i c = _mm512_loadu_si512(codes);
+        __m512i lo = _mm512_and_si512(c, low_mask);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(c, 4), low_mask);
+
+        // accumulate lower & upper results respectively
+        // accu[0][0-3] for lower 8-bit result
+        // accu[1][0-3] for upper 8-bit result
+        for (auto& i : accu) {
+            __m512i lut = _mm512_loadu_si512(hc_lut);
+
+            __m512i res_lo = _mm512_shuffle_epi8(lut, lo);
+            __m512i res_hi = _mm512_shuffle_epi8(lut, hi);
+
+            i[0] = _mm512_add_epi16(i[0], res_lo);
+            i[1] = _mm512_add_epi16(i[1], _mm512_srli_epi16(res_lo, 8));
+
+            i[2] = _mm512_add_epi16(i[2], res_hi);
+            i[3] = _mm512_add_epi16(i[3], _mm512_srli_epi16(res_hi, 8));
+
+            hc_lut += 64;
+        }
+        codes += 64;
+    }
+
+    hacc_impl::reduce_store(accu, accu_res);
 #else
     size_t num_codebook = dim >> 2; 
     std::array<int32_t, 32> accu_lo = {};  // 低8位 LUT 结果
@@ -187,4 +238,63 @@ inline void accumulate_hacc(
 
 #endif
 }
-}  // namespace rabitqlib::fastscan
\ No newline at end of file
+
+/**
+ * @brief accumulate_hacc() for two batches (64 vectors) with the same lut, each part of the
+ * lut is loaded once for both batches. accu_res[0, 32) for codes0 and [32, 64) for codes1.
+ */
+inline void accumulate_hacc_x2(
+    const uint8_t* __restrict__ codes0,
+    const uint8_t* __restrict__ codes1,
+    const uint8_t* __restrict__ hc_lut,
+    int32_t* accu_res,
+    size_t dim
+) {
+#if defined(USE_EXPLICIT_SIMD)
+    __m512i low_mask = _mm512_set1_epi8(0xf);
+    __m512i accu0[2][4];  // for codes0, same as accu in accumulate_hacc()
+    __m512i accu1[2][4];  // for codes1
+
+    for (size_t i = 0; i < 2; ++i) {
+        for (size_t j = 0; j < 4; ++j) {
+            accu0[i][j] = _mm512_setzero_si512();
+            accu1[i][j] = _mm512_setzero_si512();
+        }
+    }
+
+    auto add = [](__m512i(&accu)[4], __m512i lut, __m512i lo, __m512i hi) {
+        __m512i res_lo = _mm512_shuffle_epi8(lut, lo);
+        __m512i res_hi = _mm512_shuffle_epi8(lut, hi);
+        accu[0] = _mm512_add_epi16(accu[0], res_lo);
+        accu[1] = _mm512_add_epi16(accu[1], _mm512_srli_epi16(res_lo, 8));
+        accu[2] = _mm512_add_epi16(accu[2], res_hi);
+        accu[3] = _mm512_add_epi16(accu[3], _mm512_srli_epi16(res_hi, 8));
+    };
+
+    size_t num_codebook = dim >> 2;
+    for (size_t m = 0; m < num_codebook; m += 4) {
+        __m512i c0 = _mm512_loadu_si512(codes0);
+        __m512i c1 = _mm512_loadu_si512(codes1);
+        __m512i lo0 = _mm512_and_si512(c0, low_mask);
+        __m512i hi0 = _mm512_and_si512(_mm512_srli_epi16(c0, 4), low_mask);
+        __m512i lo1 = _mm512_and_si512(c1, low_mask);
+        __m512i hi1 = _mm512_and_si512(_mm512_srli_epi16(c1, 4), low_mask);
+
+        for (size_t i = 0; i < 2; ++i) {
+            __m512i lut = _mm512_loadu_si512(hc_lut);
+            add(accu0[i], lut, lo0, hi0);
+            add(accu1[i], lut, lo1, hi1);
+            hc_lut += 64;
+        }
+        codes0 += 64;
+        codes1 += 64;
+    }
+
+    hacc_impl::reduce_store(accu0, accu_res);
+    hacc_impl::reduce_store(accu1, accu_res + 32);
+#else
+    accumulate_hacc(codes0, hc_lut, accu_res, dim);
+    accumulate_hacc(codes1, hc_lut, accu_res + 32, dim);
+#endif
+}
+}  // namespace rabitqlib::fastscan
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <immintrin.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstdint>
+#include <type_traits>
 
 #include "defines.hpp"
 #include "fastscan/fastscan.hpp"
@@ -31,55 +37,226 @@ inline void split_batch_estdist(
     float* ip_x0_qr,
     bool use_hacc
 ) {
-    static bool log_printed = false;
-    if (!log_printed) {
-        // 获取LUT的真实内存大小（从实际vector获取）
-        size_t lut_size_bytes = q_obj.lut_size_bytes();  // 一条指令获取真实大小
-        
-        std::cerr << "[IVF-RaBitQ] LUT actual memory size:\n"
-                  << "  - LUT size: " << lut_size_bytes << " bytes ("
-                  << (lut_size_bytes / 1024.0) << " KB)\n"
-                  << "  - Use high accuracy: " << (use_hacc ? "true" : "false") << "\n";
-        
-        log_printed = true;
-    }
     ConstBatchDataMap<float> cur_batch(batch_data, padded_dim);
-    RowMajorArray<int32_t> accu_arr(1, fastscan::kBatchSize);
+    std::array<int32_t, fastscan::kBatchSize> accu_res;
 
     if (use_hacc) {
-        std::array<int32_t, fastscan::kBatchSize> accu_res;
         fastscan::accumulate_hacc(
             cur_batch.bin_code(), q_obj.lut(), accu_res.data(), padded_dim
         );
-        for (size_t i = 0; i < fastscan::kBatchSize; ++i) {
-            accu_arr.data()[i] = accu_res[i];
-        }
     } else {
-        std::array<uint16_t, fastscan::kBatchSize> accu_res;
-        fastscan::accumulate(
-            cur_batch.bin_code(), q_obj.lut(), accu_res.data(), padded_dim
-        );
-        for (size_t i = 0; i < fastscan::kBatchSize; ++i) {
-            accu_arr.data()[i] = accu_res[i];
+        std::array<uint16_t, fastscan::kBatchSize> accu_u16;
+        fastscan::accumulate(cur_batch.bin_code(), q_obj.lut(), accu_u16.data(), padded_dim);
+        std::copy(accu_u16.begin(), accu_u16.end(), accu_res.begin());
+    }
+
+    const float* f_add = cur_batch.f_add();
+    const float* f_rescale = cur_batch.f_rescale();
+    const float* f_error = cur_batch.f_error();
+    for (size_t i = 0; i < fastscan::kBatchSize; ++i) {
+        ip_x0_qr[i] = (q_obj.delta() * static_cast<float>(accu_res[i])) + q_obj.sum_vl_lut();
+        est_distance[i] =
+            f_add[i] + q_obj.g_add() + (f_rescale[i] * (ip_x0_qr[i] + q_obj.k1xsumq()));
+        low_distance[i] = est_distance[i] - (f_error[i] * q_obj.g_error());
+    }
+}
+
+namespace estimator_impl {
+/**
+ * @brief Compute ip_x0_qr, estimated distance and lower bound from accumulated results of
+ * FastScan in registers.
+ *
+ * @tparam TF storage type of factors (float, Fp16 or Bf16). For 16-bit factors, the lower
+ * bound is further reduced by the largest error caused by rounding f_add and f_rescale
+ * (f_error is rounded up when stored). Magnitudes of factors are clamped to at least
+ * kMinNormal, which also bounds the absolute error of subnormal factors.
+ * @param num  only the first num vectors (rounded up to 16) of the batch are estimated
+ * @return uint32_t i-th bit is set if (lower bound - ip_margin * |f_rescale|) of i-th
+ * vector is smaller than distk
+ */
+template <typename TA, typename TF = float>
+inline uint32_t batch_estmask(
+    const ConstBatchDataMap<TF>& cur_batch,
+    const TA* accu_res,
+    const SplitBatchQuery<float>& q_obj,
+    float delta,
+    float distk,
+    float ip_margin,
+    float* est_distance,
+    float* low_distance,
+    float* ip_x0_qr,
+    size_t num = fastscan::kBatchSize
+) {
+    // relative error of a decoded factor w.r.t. the original one
+    constexpr float kRoundoff =
+        HalfTraits<TF>::kUnitRoundoff / (1 - HalfTraits<TF>::kUnitRoundoff);
+    constexpr float kMinNormal = HalfTraits<TF>::kMinNormal;
+    uint32_t mask = 0;
+#if defined(__AVX512F__)
+    const __m512 delta512 = _mm512_set1_ps(delta);
+    const __m512 sum_vl = _mm512_set1_ps(q_obj.sum_vl_lut());
+    const __m512 g_add = _mm512_set1_ps(q_obj.g_add());
+    const __m512 k1xsumq = _mm512_set1_ps(q_obj.k1xsumq());
+    const __m512 g_error = _mm512_set1_ps(q_obj.g_error());
+    const __m512 dist_k = _mm512_set1_ps(distk);
+    const __m512 margin = _mm512_set1_ps(ip_margin);
+    for (size_t i = 0; i < num; i += 16) {
+        __m512i accu;
+        if constexpr (std::is_same_v<TA, uint16_t>) {
+            accu = _mm512_cvtepu16_epi32(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(accu_res + i))
+            );
+        } else {
+            accu = _mm512_loadu_si512(accu_res + i);
+        }
+        __m512 f_add = load_factors(cur_batch.f_add() + i);
+        __m512 f_rescale = load_factors(cur_batch.f_rescale() + i);
+        __m512 ip = _mm512_fmadd_ps(delta512, _mm512_cvtepi32_ps(accu), sum_vl);
+        __m512 ip_k1 = _mm512_add_ps(ip, k1xsumq);
+        __m512 est = _mm512_fmadd_ps(f_rescale, ip_k1, _mm512_add_ps(f_add, g_add));
+        __m512 low =
+            _mm512_fnmadd_ps(load_factors(cur_batch.f_error() + i), g_error, est);
+        if constexpr (!std::is_same_v<TF, float>) {
+            const __m512 min_normal = _mm512_set1_ps(kMinNormal);
+            __m512 rounding = _mm512_fmadd_ps(
+                _mm512_max_ps(_mm512_abs_ps(f_rescale), min_normal),
+                _mm512_abs_ps(ip_k1),
+                _mm512_max_ps(_mm512_abs_ps(f_add), min_normal)
+            );
+            low = _mm512_fnmadd_ps(rounding, _mm512_set1_ps(kRoundoff), low);
         }
+        _mm512_storeu_ps(ip_x0_qr + i, ip);
+        _mm512_storeu_ps(est_distance + i, est);
+        _mm512_storeu_ps(low_distance + i, low);
+        __m512 bound = _mm512_fnmadd_ps(_mm512_abs_ps(f_rescale), margin, low);
+        mask |= static_cast<uint32_t>(_mm512_cmp_ps_mask(bound, dist_k, _CMP_LT_OQ)) << i;
     }
+#else
+    for (size_t i = 0; i < num; ++i) {
+        float f_add = to_float(cur_batch.f_add()[i]);
+        float f_rescale = to_float(cur_batch.f_rescale()[i]);
+        ip_x0_qr[i] = (delta * static_cast<float>(accu_res[i])) + q_obj.sum_vl_lut();
+        float ip_k1 = ip_x0_qr[i] + q_obj.k1xsumq();
+        est_distance[i] = f_add + q_obj.g_add() + (f_rescale * ip_k1);
+        low_distance[i] =
+            est_distance[i] - (to_float(cur_batch.f_error()[i]) * q_obj.g_error()) -
+            (kRoundoff * (std::max(std::abs(f_add), kMinNormal) +
+                          (std::max(std::abs(f_rescale), kMinNormal) * std::abs(ip_k1))));
+        float bound = low_distance[i] - (std::abs(f_rescale) * ip_margin);
+        mask |= static_cast<uint32_t>(bound < distk) << i;
+    }
+#endif
+    return mask;
+}
+}  // namespace estimator_impl
 
-    ConstRowMajorArrayMap<float> f_add_arr(cur_batch.f_add(), 1, fastscan::kBatchSize);
-    ConstRowMajorArrayMap<float> f_rescale_arr(
-        cur_batch.f_rescale(), 1, fastscan::kBatchSize
-    );
-    ConstRowMajorArrayMap<float> f_error_arr(cur_batch.f_error(), 1, fastscan::kBatchSize);
-
-    RowMajorArrayMap<float> est_dist_arr(est_distance, 1, fastscan::kBatchSize);
-    RowMajorArrayMap<float> ip_x0_qr_arr(ip_x0_qr, 1, fastscan::kBatchSize);
-    RowMajorArrayMap<float> low_dist_arr(low_distance, 1, fastscan::kBatchSize);
-    // 它将整数的“得分”accu_arr转换为浮点数，然后通过查询对象q_obj提供的缩放因子delta和偏移因子sum_vl_lut，将其还原成一个具有物理意义的近似内积。
-    ip_x0_qr_arr = q_obj.delta() * (accu_arr.template cast<float>()) + q_obj.sum_vl_lut();
-    // 它利用欧氏距离与内积的关系 ||q-p||² ≈ C + D * <q,p> 进行转换
-    est_dist_arr =
-        f_add_arr + q_obj.g_add() + f_rescale_arr * (ip_x0_qr_arr + q_obj.k1xsumq());
-    // 它在近似距离est_dist_arr的基础上，减去了一个误差边界项。
-    low_dist_arr = est_dist_arr - f_error_arr * q_obj.g_error();
+/**
+ * @brief Fused FastScan distance estimation for a block of NumBatch adjacent batches without
+ * heap allocation. The estimation and the comparison between lower bounds and distk are done
+ * in registers. For two batches (64 vectors), each part of the lut is loaded once for both
+ * batches. For LutMode::kAdaptive, the block is scanned with 8-bit table first and
+ * re-scanned with 16-bit table only if some lower bounds are within the error of 8-bit
+ * table from distk.
+ *
+ * @tparam NumBatch   number of adjacent batches (1 or 2) in the block
+ * @param batch_data batch data of the 1st batch, refer to BatchDataMap in data_layout.hpp
+ * @param q_obj query object
+ * @param padded_dim dim, must be multiple of 16
+ * @param distk current distance of the k-th nearest neighbor
+ * @param est_distance estimated distance
+ * @param low_distance lower bound of distance
+ * @param ip_x0_qr  intermediate result for re-ranking
+ * @param num_points number of valid vectors in the block, factors of the padded lanes
+ *                   beyond it are not computed if possible
+ * @param factor_type storage type of factors in the batches
+ * @return uint64_t i-th bit is set if the lower bound of i-th vector is smaller than distk
+ */
+template <size_t NumBatch = 1>
+inline uint64_t split_batch_estmask(
+    const char* batch_data,
+    const SplitBatchQuery<float>& q_obj,
+    size_t padded_dim,
+    float distk,
+    float* est_distance,
+    float* low_distance,
+    float* ip_x0_qr,
+    size_t num_points = NumBatch * fastscan::kBatchSize,
+    FactorType factor_type = FactorType::kFp32
+) {
+    static_assert(NumBatch == 1 || NumBatch == 2, "a block contains 1 or 2 batches");
+    constexpr size_t kNum = NumBatch * fastscan::kBatchSize;
+    size_t batch_bytes = batch_data_bytes(padded_dim, factor_type);
+    alignas(64) std::array<int32_t, kNum> accu_res;
+    alignas(64) std::array<uint16_t, kNum> accu_u16;
+
+    auto bin_code = [&](size_t b) {
+        return ConstBatchDataMap<float>(batch_data + (b * batch_bytes), padded_dim).bin_code();
+    };
+    auto accumulate_hacc = [&](const uint8_t* lut) {
+        if constexpr (NumBatch == 2) {
+            fastscan::accumulate_hacc_x2(
+                bin_code(0), bin_code(1), lut, accu_res.data(), padded_dim
+            );
+        } else {
+            fastscan::accumulate_hacc(bin_code(0), lut, accu_res.data(), padded_dim);
+        }
+    };
+    auto estmask_as = [&](auto factor_tag, const auto* accu, float delta, float ip_margin) {
+        using TF = decltype(factor_tag);
+        uint64_t mask = 0;
+        for (size_t b = 0; b < NumBatch && b * fastscan::kBatchSize < num_points; ++b) {
+            size_t offset = b * fastscan::kBatchSize;
+            uint32_t cur_mask = estimator_impl::batch_estmask(
+                ConstBatchDataMap<TF>(batch_data + (b * batch_bytes), padded_dim),
+                accu + offset,
+                q_obj,
+                delta,
+                distk,
+                ip_margin,
+                est_distance + offset,
+                low_distance + offset,
+                ip_x0_qr + offset,
+                std::min(fastscan::kBatchSize, num_points - offset)
+            );
+            mask |= static_cast<uint64_t>(cur_mask) << offset;
+        }
+        return mask;
+    };
+    auto estmask = [&](const auto* accu, float delta, float ip_margin) {
+        switch (factor_type) {
+            case FactorType::kFp16:
+                return estmask_as(Fp16{}, accu, delta, ip_margin);
+            case FactorType::kBf16:
+                return estmask_as(Bf16{}, accu, delta, ip_margin);
+            default:
+                return estmask_as(float{}, accu, delta, ip_margin);
+        }
+    };
+
+    if (q_obj.lut_mode() == LutMode::kHacc) {
+        accumulate_hacc(q_obj.lut());
+        return estmask(accu_res.data(), q_obj.delta(), 0);
+    }
+
+    if constexpr (NumBatch == 2) {
+        fastscan::accumulate_x2(
+            bin_code(0), bin_code(1), q_obj.lut(), accu_u16.data(), padded_dim
+        );
+    } else {
+        fastscan::accumulate(bin_code(0), q_obj.lut(), accu_u16.data(), padded_dim);
+    }
+    if (q_obj.lut_mode() == LutMode::kU8) {
+        return estmask(accu_u16.data(), q_obj.delta(), 0);
+    }
+
+    uint64_t borderline = estmask(accu_u16.data(), q_obj.delta(), q_obj.lut_error());
+    // all vectors are clearly out of range
+    if (borderline == 0) {
+        return 0;
+    }
+
+    accumulate_hacc(q_obj.lut_hacc());
+    return estmask(accu_res.data(), q_obj.delta_hacc(), 0);
 }
 
 /**
@@ -87,6 +264,7 @@ inline void split_batch_estdist(
  *
  * @tparam Query
  * @param ex_data ex data, refer to ExDataMap in data_layout.hpp
+ * @tparam IpFunc function pointer or functor, e.g., excode_ip<ExBits> for inlining
  * @param ip_func_  inner product function for compactly stored ex codes
  * @param q_obj
  * @param padded_dim
@@ -94,10 +272,10 @@ inline void split_batch_estdist(
  * @param ip_x0_qr  intermediate result generated by 1-bit distance estimation
  * @return float
  */
-template <class Query>
+template <class Query, class IpFunc>
 inline float split_distance_boosting(
     const char* ex_data,
-    float (*ip_func_)(const float*, const uint8_t*, size_t),
+    IpFunc ip_func_,
     const Query& q_obj,
     size_t padded_dim,
     size_t ex_bits,
@@ -114,6 +292,104 @@ inline float split_distance_boosting(
     return ex_dist;
 }
 
+/**
+ * @brief Progressive version of split_distance_boosting() for ex codes stored as bit planes
+ * (ExCodeLayout::kBitPlane). Planes are read from the most significant one. Each unread
+ * code is in [0, rest] (rest is the max value of unread planes), thus the unread planes
+ * contribute a value in [rest * sum(q-), rest * sum(q+)], where sum(q+) and sum(q-) are
+ * the sums of positive and negative elements of the query. Two planes are read in each
+ * pass over the query. Once the lower bound exceeds distk, the remaining planes are
+ * skipped.
+ *
+ * @return float boosted distance, or a lower bound larger than distk if terminated early
+ */
+template <class Query>
+inline float split_distance_progressive(
+    const char* ex_data,
+    const Query& q_obj,
+    size_t padded_dim,
+    size_t ex_bits,
+    float ip_x0_qr,
+    float distk
+) {
+    ConstExDataMap<float> cur_ex(ex_data, padded_dim, ex_bits);
+    const float* query = q_obj.rotated_query();
+    const uint8_t* plane = cur_ex.ex_code();
+    const size_t plane_bytes = padded_dim / 8;
+
+    float f_rescale = cur_ex.f_rescale_ex();
+    float base = cur_ex.f_add_ex() + q_obj.g_add() +
+                 (f_rescale * (static_cast<float>(1 << ex_bits) * ip_x0_qr + q_obj.kbxsumq()));
+    // the unread planes decrease the distance most with this sum of query
+    float sumq_low = f_rescale >= 0 ? q_obj.sumq_neg() : q_obj.sumq_pos();
+
+    float ip_ex = 0;
+    for (size_t p = 0; p < ex_bits; p += 2) {
+        size_t weight = 1UL << (ex_bits - 1 - p);
+        if (p + 1 < ex_bits) {
+            float ip_hi;
+            float ip_lo;
+            excode_ipimpl::ip16_fxu1x2_avx512(
+                query, plane, plane + plane_bytes, padded_dim, ip_hi, ip_lo
+            );
+            ip_ex += static_cast<float>(weight) * ip_hi;
+            ip_ex += static_cast<float>(weight >> 1) * ip_lo;
+            plane += 2 * plane_bytes;
+            weight >>= 1;
+        } else {
+            ip_ex += static_cast<float>(weight) *
+                     excode_ipimpl::ip16_fxu1_avx512(query, plane, padded_dim);
+            plane += plane_bytes;
+        }
+
+        auto rest = static_cast<float>(weight - 1);  // max value of unread planes
+        if (rest > 0) {
+            float low = base + (f_rescale * (ip_ex + (rest * sumq_low)));
+            if (low > distk) {
+                return low;
+            }
+        }
+    }
+    return base + (f_rescale * ip_ex);
+}
+
+/**
+ * @brief Batch version of split_distance_boosting() for num (<= kExIpBatch) candidates,
+ * the ip of ex codes are computed together by ip_batch_func (e.g., excode_ip_batch)
+ *
+ * @param ex_data ex data of each candidate
+ * @param ip_x0_qr intermediate results of each candidate
+ * @param ex_dist  output, boosted distances of candidates
+ * @param g_add    g_add of each candidate, q_obj.g_add() is used for all if nullptr
+ */
+template <class Query, class IpBatchFunc>
+inline void split_distance_boosting_batch(
+    const char* const* ex_data,
+    size_t num,
+    IpBatchFunc ip_batch_func,
+    const Query& q_obj,
+    size_t padded_dim,
+    size_t ex_bits,
+    const float* ip_x0_qr,
+    float* ex_dist,
+    const float* g_add = nullptr
+) {
+    std::array<const uint8_t*, kExIpBatch> codes;
+    std::array<float, kExIpBatch> ip_ex;
+    for (size_t j = 0; j < num; ++j) {
+        codes[j] = reinterpret_cast<const uint8_t*>(ex_data[j]);
+    }
+    ip_batch_func(q_obj.rotated_query(), codes.data(), num, padded_dim, ip_ex.data());
+
+    for (size_t j = 0; j < num; ++j) {
+        ConstExDataMap<float> cur_ex(ex_data[j], padded_dim, ex_bits);
+        ex_dist[j] = cur_ex.f_add_ex() + (g_add == nullptr ? q_obj.g_add() : g_add[j]) +
+                     (cur_ex.f_rescale_ex() *
+                      (static_cast<float>(1 << ex_bits) * ip_x0_qr[j] + ip_ex[j] +
+                       q_obj.kbxsumq()));
+    }
+}
+
 /**
  * @brief Batch distance estimation for qg. Here, we do not need intermediate results and
  * lower bound
@@ -185,13 +461,8 @@ inline void split_single_estdist(
 ) {
     ConstBinDataMap<float> cur_bin(bin_data, padded_dim);
 
-    ip_x0_qr = warmup_ip_x0_q<SplitSingleQuery<float>::kNumBits>(
-        cur_bin.bin_code(),
-        q_obj.query_bin(),
-        q_obj.delta(),
-        q_obj.vl(),
-        padded_dim,
-        SplitSingleQuery<float>::kNumBits
+    ip_x0_qr = warmup_ip_x0_q_planes<SplitSingleQuery<float>::kNumBits>(
+        cur_bin.bin_code(), q_obj.query_planes(), q_obj.delta(), q_obj.vl(), padded_dim
     );
 
     est_dist = cur_bin.f_add() + g_add + cur_bin.f_rescale() * (ip_x0_qr + q_obj.k1xsumq());
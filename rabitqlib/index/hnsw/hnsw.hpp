@@ -4,6 +4,7 @@
 #include <immintrin.h>
 #include <omp.h>
 
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <cstddef>
@@ -13,6 +14,7 @@
 #include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "defines.hpp"
@@ -51,6 +53,12 @@ class HierarchicalNSW {
         const float*, size_t, size_t, size_t, size_t
     );
 
+    void set_early_stop(size_t, bool = false);
+
+    void set_deferred_rerank(bool);
+
+    void set_visited_set(VisitedSetType);
+
     const float* rawDataPtr_{nullptr};
 
     struct ResultRecord {
@@ -115,6 +123,9 @@ class HierarchicalNSW {
     size_t maxM0_{0};
     size_t ef_construction_{0};
     size_t ef_{0};
+    size_t patience_{0};      // stop search if top-k not improved for patience_ expansions
+    bool bound_stop_{false};  // stop search if lower bounds of candidates exceed distk
+    bool deferred_rerank_{false};  // rerank promising neighbors after each expansion
     MetricType metric_type_;
 
     double mult_{0.0}, revSize_{0.0};
@@ -155,8 +166,10 @@ class HierarchicalNSW {
     mutable std::atomic<long> metric_hops_{0};
 
     std::unique_ptr<VisitedListPool> visited_list_pool_{nullptr};
+    VisitedSetType visited_type_{VisitedSetType::kHashBased};  // kind of visited sets
 
     float (*ip_func_)(const float*, const uint8_t*, size_t);
+    ex_ipbatch_func ip_batch_func_ = nullptr;
 
     Rotator<float>* rotator_ = nullptr;
 
@@ -192,7 +205,16 @@ class HierarchicalNSW {
         rotator_ = nullptr;
     }
 
-    void set_ef(size_t ef) { ef_ = ef; }
+    void set_ef(size_t ef) {
+        ef_ = ef;
+        visited_list_pool_->set_capacity(visited_capacity());
+    }
+
+    // each expansion visits at most maxM0_ neighbors, most searches expand less than ef
+    // vertices
+    [[nodiscard]] size_t visited_capacity() const {
+        return std::max(ef_, ef_construction_) * maxM0_;
+    }
 
     std::mutex& get_lable_op_mutex(PID label) const {
         // calculate hash
@@ -362,6 +384,7 @@ inline HierarchicalNSW::HierarchicalNSW(
     assert(padded_dim_ % 64 == 0);
 
     ip_func_ = select_excode_ipfunc(ex_bits_);
+    ip_batch_func_ = select_excode_ipbatch(ex_bits_);
 
     if (M <= 10000) {
         M_ = M;
@@ -400,7 +423,9 @@ inline HierarchicalNSW::HierarchicalNSW(
 
     cur_element_count_ = 0;
 
-    visited_list_pool_ = std::make_unique<VisitedListPool>(1, max_elements_);
+    visited_list_pool_ = std::make_unique<VisitedListPool>(
+        1, max_elements_, visited_type_, visited_capacity()
+    );
 
     // initializations for special treatment of the first node
     enterpoint_node_ = -1;
@@ -496,6 +521,7 @@ inline void HierarchicalNSW::load(const char* filename, MetricType metric_type_i
     input.read(reinterpret_cast<char*>(&ex_bits_), sizeof(size_t));
 
     ip_func_ = select_excode_ipfunc(ex_bits_);
+    ip_batch_func_ = select_excode_ipbatch(ex_bits_);
 
     input.read(reinterpret_cast<char*>(&size_bin_data_), sizeof(size_t));
     input.read(reinterpret_cast<char*>(&size_ex_data_), sizeof(size_t));
@@ -560,7 +586,9 @@ inline void HierarchicalNSW::load(const char* filename, MetricType metric_type_i
         }
     }
 
-    visited_list_pool_ = std::make_unique<VisitedListPool>(1, max_elements_);
+    visited_list_pool_ = std::make_unique<VisitedListPool>(
+        1, max_elements_, visited_type_, visited_capacity()
+    );
 
     rotator_ = choose_rotator<float>(
         dim_, RotatorType::FhtKacRotator, round_up_to_multiple(dim_, 64)
@@ -739,7 +767,7 @@ inline void HierarchicalNSW::add_point(
 inline maxheap<std::pair<float, PID>> HierarchicalNSW::search_base_layer(
     PID ep_id, PID cur_c, int layer
 ) {
-    HashBasedBooleanSet* vl = visited_list_pool_->get_free_vislist();
+    VisitedSet* vl = visited_list_pool_->get_free_vislist();
 
     maxheap<std::pair<float, PID>> top_candidates;
     minheap<std::pair<float, PID>> candidate_set;
@@ -1062,6 +1090,38 @@ inline void HierarchicalNSW::get_full_est(
     }
 }
 
+/**
+ * @brief adaptive early termination for base layer search, ef still bounds the search pool
+ *
+ * @param patience      stop once the top-k results are not improved for patience
+ *                      consecutive expansions, 0 disables this rule
+ * @param bound_stop    stop once the lower bounds of all remaining candidates exceed the
+ *                      k-th estimated distance
+ */
+inline void HierarchicalNSW::set_early_stop(size_t patience, bool bound_stop) {
+    patience_ = patience;
+    bound_stop_ = bound_stop;
+}
+
+/**
+ * @brief defer the refinement of promising neighbors to the end of each expansion. Ex data
+ * of all promising neighbors are prefetched first and then refined together in batches of
+ * kExIpBatch. Neighbors whose lower bounds exceed the updated distk are skipped.
+ */
+inline void HierarchicalNSW::set_deferred_rerank(bool deferred_rerank) {
+    deferred_rerank_ = deferred_rerank;
+}
+
+/**
+ * @brief choose the kind of visited sets used by construction and search
+ */
+inline void HierarchicalNSW::set_visited_set(VisitedSetType type) {
+    visited_type_ = type;
+    visited_list_pool_ = std::make_unique<VisitedListPool>(
+        1, max_elements_, visited_type_, visited_capacity()
+    );
+}
+
 inline std::vector<std::vector<std::pair<float, PID>>> HierarchicalNSW::search(
     const float* queries, size_t query_num, size_t TOPK, size_t efSearch, size_t thread_num
 ) {
@@ -1189,7 +1249,7 @@ void HierarchicalNSW::searchBaseLayerST_AdaptiveRerankOpt(
     [[maybe_unused]] const float* query,
     BoundedKNN& boundedKNN
 ) {
-    HashBasedBooleanSet* vl = visited_list_pool_->get_free_vislist();
+    VisitedSet* vl = visited_list_pool_->get_free_vislist();
 
     // Use our bounded priority queue instead of the maxheap.
     buffer::SearchBuffer<float> candidate_set(ef);
@@ -1209,7 +1269,90 @@ void HierarchicalNSW::searchBaseLayerST_AdaptiveRerankOpt(
 
     vl->set(ep_id);
 
+    // For early termination. max_error bounds (est_dist - low_dist) of all candidates in
+    // candidate_set, thus next_dist() - max_error is a lower bound for all of them.
+    float max_error = est_dist - low_dist;
+    size_t num_stale = 0;
+    auto kth_dist = [&]() {
+        return boundedKNN.size() < TOPK ? std::numeric_limits<float>::max()
+                                        : boundedKNN.worst().record.est_dist;
+    };
+
+    // Promising neighbors of the current expansion, refined by rerank_pending() together
+    // after all neighbors are estimated with 1-bit codes.
+    std::vector<std::pair<PID, EstimateRecord>> pending;
+    pending.reserve(maxM0_);
+    size_t ex_lines = size_ex_data_ / 64;
+    auto insert_candidate = [&](PID candidate_id, const EstimateRecord& candest) {
+        if (!candidate_set.is_full(candest.est_dist)) {
+            candidate_set.insert(candidate_id, candest.est_dist);
+            max_error = std::max(max_error, candest.est_dist - candest.low_dist);
+        }
+    };
+    auto rerank_pending = [&]() {
+        std::array<size_t, kExIpBatch> idx;
+        std::array<const char*, kExIpBatch> ex_data;
+        std::array<float, kExIpBatch> ip_x0_qr;
+        std::array<float, kExIpBatch> g_add;
+        std::array<float, kExIpBatch> ex_dist;
+        size_t num = 0;
+        auto flush = [&]() {
+            split_distance_boosting_batch(
+                ex_data.data(),
+                num,
+                ip_batch_func_,
+                query_wrapper,
+                padded_dim_,
+                ex_bits_,
+                ip_x0_qr.data(),
+                ex_dist.data(),
+                g_add.data()
+            );
+            for (size_t j = 0; j < num; ++j) {
+                auto& [candidate_id, candest] = pending[idx[j]];
+                candest.low_dist =
+                    ex_dist[j] - ((candest.est_dist - candest.low_dist) / (1 << ex_bits_));
+                candest.est_dist = ex_dist[j];
+                boundedKNN.insert(
+                    {ResultRecord(candest.est_dist, candest.low_dist), candidate_id}
+                );
+                insert_candidate(candidate_id, candest);
+            }
+            distk = boundedKNN.worst().record.est_dist;
+            num = 0;
+        };
+        for (size_t i = 0; i < pending.size(); ++i) {
+            auto& [candidate_id, candest] = pending[i];
+            // distk may be tightened by the candidates reranked before
+            if (boundedKNN.size() >= TOPK && candest.low_dist >= distk) {
+                insert_candidate(candidate_id, candest);
+                continue;
+            }
+            float norm = q_to_centroids[get_clusterid_by_internalid(candidate_id)];
+            ConstBinDataMap<float> cur_bin(get_bindata_by_internalid(candidate_id), padded_dim_);
+            idx[num] = i;
+            ex_data[num] = get_exdata_by_internalid(candidate_id);
+            // candest.ip_x0_qr is computed with the 4-bit query, its error is amplified by
+            // 2^ex_bits in the boosted distance, thus the exact one is used here
+            ip_x0_qr[num] =
+                mask_ip_x0_q(query_wrapper.rotated_query(), cur_bin.bin_code(), padded_dim_);
+            g_add[num] = metric_type_ == METRIC_IP ? -norm : norm * norm;
+            if (++num == kExIpBatch) {
+                flush();
+            }
+        }
+        if (num > 0) {
+            flush();
+        }
+        pending.clear();
+    };
+
     while (candidate_set.has_next()) {
+        float prev_distk = kth_dist();
+        if (bound_stop_ && candidate_set.next_dist() - max_error > prev_distk) {
+            break;
+        }
+
         // Step 1 - get the next node to explore.
         PID current_node_id = candidate_set.pop();
         int* data = (int*)get_linklist0(current_node_id);
@@ -1228,13 +1371,20 @@ void HierarchicalNSW::searchBaseLayerST_AdaptiveRerankOpt(
                 vl->set(candidate_id);
                 EstimateRecord candest;
                 get_bin_est(q_to_centroids, query_wrapper, candidate_id, candest);
+                bool deferred = false;
 
                 if (ex_bits_ > 0) {
                     // Check preliminary score against current worst full estimate.
                     bool flag_update_KNNs =
                         boundedKNN.size() < TOPK || candest.low_dist < distk;
 
-                    if (flag_update_KNNs) {
+                    if (flag_update_KNNs && deferred_rerank_) {
+                        rabitqlib::memory::mem_prefetch_l1(
+                            get_exdata_by_internalid(candidate_id), ex_lines
+                        );
+                        pending.emplace_back(candidate_id, candest);
+                        deferred = true;
+                    } else if (flag_update_KNNs) {
                         // Compute the full estimate if promising.
                         get_full_est(q_to_centroids, query_wrapper, candidate_id, candest);
                         Candidate cand{
@@ -1252,8 +1402,8 @@ void HierarchicalNSW::searchBaseLayerST_AdaptiveRerankOpt(
                     boundedKNN.insert(cand);
                 }
 
-                if (!candidate_set.is_full(candest.est_dist)) {
-                    candidate_set.insert(candidate_id, candest.est_dist);
+                if (!deferred) {
+                    insert_candidate(candidate_id, candest);
                 }
 
                 rabitqlib::memory::mem_prefetch_l2(
@@ -1261,6 +1411,15 @@ void HierarchicalNSW::searchBaseLayerST_AdaptiveRerankOpt(
                 );
             }
         }
+        if (!pending.empty()) {
+            rerank_pending();
+        }
+
+        bool improved = boundedKNN.size() < TOPK || kth_dist() < prev_distk;
+        num_stale = improved ? 0 : num_stale + 1;
+        if (patience_ > 0 && num_stale >= patience_) {
+            break;
+        }
     }
 
     visited_list_pool_->release_vis_list(vl);
@@ -16,10 +16,10 @@ class Cluster {
     size_t num_;                  // Num of vectors in this cluster
     char* batch_data_ = nullptr;  // RaBitQ code and factors
     char* ex_data_ = nullptr;     // Ex code and factors
-    PID* ids_ = nullptr;          // PID of vectors
+    PID first_ordinal_ = 0;       // ordinal of the 1st vector, see PackedIds
 
    public:
-    explicit Cluster(size_t, char*, char*, PID*);
+    explicit Cluster(size_t, char*, char*, PID);
     Cluster(const Cluster& other);
     Cluster(Cluster&& other) noexcept;
     ~Cluster() {}
@@ -28,23 +28,23 @@ class Cluster {
 
     [[nodiscard]] char* ex_data() const { return ex_data_; }
 
-    [[nodiscard]] PID* ids() const { return this->ids_; }
+    [[nodiscard]] PID first_ordinal() const { return this->first_ordinal_; }
 
     [[nodiscard]] size_t num() const { return num_; }
 };
 
-inline Cluster::Cluster(size_t num, char* batch_data, char* ex_data, PID* ids)
-    : num_(num), batch_data_(batch_data), ex_data_(ex_data), ids_(ids) {}
+inline Cluster::Cluster(size_t num, char* batch_data, char* ex_data, PID first_ordinal)
+    : num_(num), batch_data_(batch_data), ex_data_(ex_data), first_ordinal_(first_ordinal) {}
 
 inline Cluster::Cluster(const Cluster& other)
     : num_(other.num_)
     , batch_data_(other.batch_data_)
     , ex_data_(other.ex_data_)
-    , ids_(other.ids_) {}
+    , first_ordinal_(other.first_ordinal_) {}
 
 inline Cluster::Cluster(Cluster&& other) noexcept
     : num_(other.num_)
     , batch_data_(other.batch_data_)
     , ex_data_(other.ex_data_)
-    , ids_(other.ids_) {}
+    , first_ordinal_(other.first_ordinal_) {}
 }  // namespace rabitqlib::ivf
\ No newline at end of file
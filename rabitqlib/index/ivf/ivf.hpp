@@ -9,6 +9,7 @@
 #include <cstddef>
 #include <fstream>
 #include <iostream>
+#include <utility>
 #include <vector>
 
 #include "defines.hpp"
@@ -16,6 +17,7 @@
 #include "index/estimator.hpp"
 #include "index/ivf/cluster.hpp"
 #include "index/ivf/initializer.hpp"
+#include "index/ivf/packed_ids.hpp"
 #include "index/query.hpp"
 #include "quantization/data_layout.hpp"
 #include "quantization/rabitq.hpp"
@@ -24,13 +26,21 @@
 #include "utils/rotator.hpp"
 #include "utils/space.hpp"
 
+// specialized scan kernels are flattened to propagate compile-time dim and ex_bits into
+// callees, see IVF::select_scan_func()
+#if defined(RABITQ_SPECIALIZED_SCAN)
+#define RABITQ_SCAN_FLATTEN __attribute__((flatten))
+#else
+#define RABITQ_SCAN_FLATTEN
+#endif
+
 namespace rabitqlib::ivf {
 class IVF {
    private:
     Initializer* initer_ = nullptr;      // initializer for find candidate cluster
     char* batch_data_ = nullptr;         // 1-bit code and factors
     char* ex_data_ = nullptr;            // code for remaining bits
-    PID* ids_ = nullptr;                 // PID of vectors (orgnized by clusters)
+    PackedIds ids_;                      // PID of vectors (orgnized by clusters)
     size_t num_;                         // num of data points
     size_t dim_;                         // dimension of data points
     size_t padded_dim_;                  // dimension after padding,
@@ -40,17 +50,42 @@ class IVF {
     Rotator<float>* rotator_ = nullptr;  // Data Rotator
     std::vector<Cluster> cluster_lst_;   // List of clusters in ivf
     MetricType metric_type_ = rabitqlib::METRIC_L2; // metric type
-    float (*ip_func_)(const float*, const uint8_t*, size_t) = nullptr;
+    ExCodeLayout ex_layout_ = ExCodeLayout::kPacked;  // layout of ex codes
+    FactorType factor_type_ = FactorType::kFp32;      // storage type of batch factors
+    ex_ipbatch_func ip_batch_func_ = nullptr;  // batch ip function for ex codes
+    ex_ipbatch_int_func<int8_t> ip_batch_i8_func_ = nullptr;    // for int8 query
+    ex_ipbatch_int_func<int16_t> ip_batch_i16_func_ = nullptr;  // for int16 query
+    bool int_query_ = false;  // quantize query to integers for ex codes, see set_int_query()
+
+    // per-thread buffers for quantizing batches during construction
+    template <typename TI>
+    struct BuildScratch {
+        std::vector<TI> raw_data;         // gathered vectors of a batch
+        std::vector<float> rotated_data;  // rotated vectors of a batch
+        std::vector<char> fp32_batch;     // batch with float factors, see factor_type_
+    };
 
-    void quantize_cluster(
-        Cluster&,
-        const std::vector<PID>&,
+    template <typename TI>
+    bool quantize_batch(
+        const Cluster&,
+        size_t,
+        const PID*,
+        const TI*,
         const float*,
-        const float*,
-        float*,
+        const quant::RabitqConfig&,
+        BuildScratch<TI>&
+    ) const;
+
+    template <typename TI>
+    bool quantize_tasks(
+        const std::vector<std::pair<PID, PID>>&,
+        const std::vector<std::vector<PID>>&,
+        const TI*,
+        const std::vector<float>&,
         const quant::RabitqConfig&
-    );
+    ) const;
 
+    // bytes of uncompressed ids in index files
     [[nodiscard]] size_t ids_bytes() const { return sizeof(PID) * num_; }
 
     // get num of bytes used for 1-bit code and corresponding factors
@@ -60,7 +95,7 @@ class IVF {
         for (auto size : cluster_sizes) {
             total_blocks += div_round_up(size, fastscan::kBatchSize);
         }
-        return total_blocks * BatchDataMap<float>::data_bytes(padded_dim_);
+        return total_blocks * rabitqlib::batch_data_bytes(padded_dim_, factor_type_);
     }
 
     [[nodiscard]] size_t ex_data_bytes() const {
@@ -75,52 +110,121 @@ class IVF {
         ::delete initer_;
         std::free(batch_data_);
         std::free(ex_data_);
-        std::free(ids_);
     }
 
     void search_cluster(
-        const Cluster&, const SplitBatchQuery<float>&, buffer::SearchBuffer<float>&, bool
+        const Cluster&, const SplitBatchQuery<float>&, buffer::SearchBuffer<float>&
+    ) const;
+
+    // template args of the generic scan kernel, i.e., use padded_dim_ and ex_bits_
+    static constexpr size_t kAnyDim = 0;
+    static constexpr size_t kAnyExBits = ~static_cast<size_t>(0);
+
+    using ScanFunc = void (IVF::*)(
+        const char*,
+        const char*,
+        PID,
+        const SplitBatchQuery<float>&,
+        buffer::SearchBuffer<float>&,
+        size_t
     ) const;
+    ScanFunc scan_func_ = nullptr;       // kernel for scanning a batch, see select_scan_func()
+    ScanFunc scan_wide_func_ = nullptr;  // kernel for scanning two adjacent batches
 
-    void scan_one_batch(
+    template <size_t Dim, size_t ExBits, size_t NumBatch>
+    void scan_block(
         const char* batch_data,
         const char* ex_data,
-        const PID* ids,
+        PID first_ordinal,
         const SplitBatchQuery<float>& q_obj,
         buffer::SearchBuffer<float>& knns,
-        size_t num_points,
-        bool
+        size_t num_points
     ) const;
 
+    template <size_t Dim, size_t NumBatch>
+    static ScanFunc scan_func_for(size_t ex_bits);
+
+    template <size_t Dim>
+    void set_scan_funcs();
+
+    void select_scan_func();
+
    public:
+    /**
+     * @brief Reusable buffers for preprocessing queries. Keep one per thread and pass it to
+     * search() so that queries are rotated and prepared without allocating memory.
+     */
+    struct SearchScratch {
+        std::vector<float, memory::AlignedAllocator<float>> rotated_query;
+        std::vector<AnnCandidate<float>> centroid_dist;
+        SplitBatchQuery<float> q_obj;
+    };
+
     explicit IVF() {}
     explicit IVF(
-        size_t, size_t, size_t, size_t, RotatorType type = RotatorType::FhtKacRotator, MetricType metric_type = rabitqlib::METRIC_L2
+        size_t,
+        size_t,
+        size_t,
+        size_t,
+        RotatorType type = RotatorType::FhtKacRotator,
+        MetricType metric_type = rabitqlib::METRIC_L2,
+        ExCodeLayout ex_layout = ExCodeLayout::kPacked,
+        FactorType factor_type = FactorType::kFp32
     );
 
     ~IVF();
 
-    void construct(const float*, const float*, const PID*, bool);
+    template <typename TI>
+    void construct(const TI*, const float*, const PID*, bool faster = false);
 
     void save(const char*) const;
 
     void load(const char*);
 
-    void search(const float*, size_t, size_t, PID*, bool) const;
+    template <typename TI>
+    void search(const TI*, size_t, size_t, PID*, bool use_hacc = true) const;
+
+    template <typename TI>
+    void search(const TI*, size_t, size_t, PID*, LutMode) const;
+
+    template <typename TI>
+    void search(const TI*, size_t, size_t, PID*, LutMode, SearchScratch&) const;
 
     [[nodiscard]] size_t padded_dim() const { return this->padded_dim_; }
 
     [[nodiscard]] size_t num_clusters() const { return this->num_cluster_; }
+
+    [[nodiscard]] ExCodeLayout ex_layout() const { return this->ex_layout_; }
+
+    [[nodiscard]] FactorType factor_type() const { return this->factor_type_; }
+
+    /**
+     * @brief Quantize the rotated query to int8 (ex_bits <= 3) or int16 for computing ip
+     * with ex codes (packed layout only), so that integer dot products (VNNI if available)
+     * are used instead of converting codes to float.
+     */
+    void set_int_query(bool int_query) { this->int_query_ = int_query; }
 };
 
-inline IVF::IVF(size_t n, size_t dim, size_t cluster_num, size_t bits, RotatorType type, MetricType metric_type)
+inline IVF::IVF(
+    size_t n,
+    size_t dim,
+    size_t cluster_num,
+    size_t bits,
+    RotatorType type,
+    MetricType metric_type,
+    ExCodeLayout ex_layout,
+    FactorType factor_type
+)
     : num_(n)
     , dim_(dim)
     , padded_dim_(dim)
     , num_cluster_(cluster_num)
     , ex_bits_(bits - 1)
     , type_(type)
-    , metric_type_(metric_type) {
+    , metric_type_(metric_type)
+    , ex_layout_(ex_layout)
+    , factor_type_(factor_type) {
     if (bits < 1 || bits > 9) {
         std::cerr << "Invalid number of bits for quantization in IVF::IVF\n";
         std::cerr << "Expected: 1 to 9  Input:" << bits << '\n';
@@ -142,12 +246,15 @@ inline IVF::~IVF() {
 /**
  * @brief Construct clusters in IVF
  *
+ * @tparam TI type of data objects, float, uint8_t (e.g., .bvecs), Fp16 or Bf16. Vectors
+ * are converted to float by the rotator, so the input is never copied as a whole.
  * @param data Data objects (N*DIM)
  * @param centroids Centroid vectors (K*DIM)
  * @param clustter_ids Cluster ID for each data objects
  */
+template <typename TI>
 inline void IVF::construct(
-    const float* data, const float* centroids, const PID* cluster_ids, bool faster = false
+    const TI* data, const float* centroids, const PID* cluster_ids, bool faster
 ) {
     std::cout << "Start IVF construction...\n";
 
@@ -157,7 +264,7 @@ inline void IVF::construct(
     std::vector<std::vector<PID>> id_lists(num_cluster_);
     for (size_t i = 0; i < num_; ++i) {
         PID cid = cluster_ids[i];
-        if (cid > num_cluster_) {
+        if (cid >= num_cluster_) {
             std::cerr << "Bad cluster id\n";
             exit(1);
         }
@@ -172,20 +279,58 @@ inline void IVF::construct(
 
     // all rotated centroids
     std::vector<float> rotated_centroids(num_cluster_ * padded_dim_);
+    this->rotator_->rotate_batch(centroids, num_cluster_, rotated_centroids.data());
 
     quant::RabitqConfig config;
     if (faster) {
         config = quant::faster_config(padded_dim_, ex_bits_ + 1);
     }
+    config.ex_layout = ex_layout_;
 
-    /* Quantize each cluster */
-#pragma omp parallel for schedule(dynamic)
+    // batches are written to the locations of clusters, check sizes before quantization
+    size_t added_vectors = 0;
     for (size_t i = 0; i < num_cluster_; ++i) {
-        const float* cur_centroid = centroids + (i * dim_);
-        float* cur_rotated_c = &rotated_centroids[i * padded_dim_];
-        Cluster& cp = cluster_lst_[i];
-        quantize_cluster(cp, id_lists[i], data, cur_centroid, cur_rotated_c, config);
+        if (cluster_lst_[i].num() != id_lists[i].size()) {
+            std::cerr << "Size of cluster and IDs are inequivalent\n";
+            std::cerr << "Cluster: " << cluster_lst_[i].num()
+                      << " IDs: " << id_lists[i].size() << '\n';
+            exit(1);
+        }
+        added_vectors += id_lists[i].size();
+    }
+    if (added_vectors != num_) {
+        std::cerr << "The sum of cluster num != total number of points\n";
+        exit(1);
+    }
+
+    /* Quantize each batch. Clusters are split into tasks of one batch, so that oversized
+     * clusters are shared by all threads. Tasks write to their final locations. */
+    std::vector<std::pair<PID, PID>> tasks;  // (cluster id, idx of batch in the cluster)
+    tasks.reserve(div_round_up(num_, fastscan::kBatchSize) + num_cluster_);
+    for (size_t i = 0; i < num_cluster_; ++i) {
+        for (size_t j = 0; j < div_round_up(counts[i], fastscan::kBatchSize); ++j) {
+            tasks.emplace_back(static_cast<PID>(i), static_cast<PID>(j));
+        }
+    }
+
+    if (!quantize_tasks(tasks, id_lists, data, rotated_centroids, config)) {
+        // factors are only known after quantization, thus the whole index is re-quantized
+        std::cerr << "\tFactors are out of the range of the storage type, fall back to "
+                     "FactorType::kFp32\n";
+        factor_type_ = FactorType::kFp32;
+        std::free(batch_data_);
+        this->batch_data_ = memory::align_allocate<64, char, true>(batch_data_bytes(counts));
+        cluster_lst_.clear();
+        init_clusters(counts);
+        quantize_tasks(tasks, id_lists, data, rotated_centroids, config);
+    }
+
+    std::vector<PID> ids;
+    ids.reserve(num_);
+    for (const auto& id_list : id_lists) {
+        ids.insert(ids.end(), id_list.begin(), id_list.end());
     }
+    ids_.build(ids.data(), counts);
 
     this->initer_->add_vectors(rotated_centroids.data());
 }
@@ -202,9 +347,83 @@ inline void IVF::allocate_memory(const std::vector<size_t>& cluster_sizes) {
     if (ex_bits_ > 0) {
         this->ex_data_ = memory::align_allocate<64, char, true>(ex_data_bytes());
     }
-    this->ids_ = memory::align_allocate<64, PID, true>(ids_bytes());
 
-    this->ip_func_ = select_excode_ipfunc(ex_bits_);
+    this->ip_batch_func_ = select_excode_ipbatch(ex_bits_);
+    this->ip_batch_i8_func_ = select_excode_ipbatch_int<int8_t>(ex_bits_);
+    this->ip_batch_i16_func_ = select_excode_ipbatch_int<int16_t>(ex_bits_);
+    select_scan_func();
+}
+
+template <size_t Dim, size_t NumBatch>
+inline IVF::ScanFunc IVF::scan_func_for(size_t ex_bits) {
+    switch (ex_bits) {
+        case 0:
+            return &IVF::scan_block<Dim, 0, NumBatch>;
+        case 1:
+            return &IVF::scan_block<Dim, 1, NumBatch>;
+        case 2:
+            return &IVF::scan_block<Dim, 2, NumBatch>;
+        case 3:
+            return &IVF::scan_block<Dim, 3, NumBatch>;
+        case 4:
+            return &IVF::scan_block<Dim, 4, NumBatch>;
+        case 5:
+            return &IVF::scan_block<Dim, 5, NumBatch>;
+        case 6:
+            return &IVF::scan_block<Dim, 6, NumBatch>;
+        case 7:
+            return &IVF::scan_block<Dim, 7, NumBatch>;
+        case 8:
+            return &IVF::scan_block<Dim, 8, NumBatch>;
+        default:
+            return &IVF::scan_block<kAnyDim, kAnyExBits, NumBatch>;
+    }
+}
+
+/**
+ * @brief Choose the kernel for scanning blocks. By default the generic kernel is used.
+ * Define RABITQ_SPECIALIZED_SCAN to instantiate kernels with compile-time dim and ex_bits
+ * for common padded dimensions (e.g., 96 and 128 are padded to 128, 200 to 256, 420 to
+ * 448), so that loops over the codes can be fully unrolled and the ex-code ip function can
+ * be inlined. It notably increases compilation time.
+ */
+inline void IVF::select_scan_func() {
+#if defined(RABITQ_SPECIALIZED_SCAN)
+    switch (padded_dim_) {
+        case 128:
+            set_scan_funcs<128>();
+            return;
+        case 256:
+            set_scan_funcs<256>();
+            return;
+        case 448:
+            set_scan_funcs<448>();
+            return;
+        case 768:
+            set_scan_funcs<768>();
+            return;
+        case 960:
+            set_scan_funcs<960>();
+            return;
+        case 1536:
+            set_scan_funcs<1536>();
+            return;
+        default:
+            break;
+    }
+#endif
+    set_scan_funcs<kAnyDim>();
+}
+
+template <size_t Dim>
+inline void IVF::set_scan_funcs() {
+    if constexpr (Dim == kAnyDim) {
+        scan_func_ = &IVF::scan_block<kAnyDim, kAnyExBits, 1>;
+        scan_wide_func_ = &IVF::scan_block<kAnyDim, kAnyExBits, 2>;
+    } else {
+        scan_func_ = scan_func_for<Dim, 1>(ex_bits_);
+        scan_wide_func_ = scan_func_for<Dim, 2>(ex_bits_);
+    }
 }
 
 /**
@@ -214,19 +433,19 @@ inline void IVF::init_clusters(const std::vector<size_t>& cluster_sizes) {
     this->cluster_lst_.reserve(num_cluster_);
     size_t added_vectors = 0;
     size_t added_batches = 0;
+    size_t batch_bytes = rabitqlib::batch_data_bytes(padded_dim_, factor_type_);
     for (size_t i = 0; i < num_cluster_; ++i) {
         // find data location for current cluster
         size_t num = cluster_sizes[i];
         size_t num_batches = div_round_up(num, fastscan::kBatchSize);
 
-        char* current_batch_data =
-            batch_data_ + (BatchDataMap<float>::data_bytes(padded_dim_) * added_batches);
+        char* current_batch_data = batch_data_ + (batch_bytes * added_batches);
         char* current_ex_data =
             ex_data_ +
             (added_vectors * ExDataMap<float>::data_bytes(padded_dim_, ex_bits_));
-        PID* ids = ids_ + added_vectors;
-
-        Cluster cur_cluster(num, current_batch_data, current_ex_data, ids);
+        Cluster cur_cluster(
+            num, current_batch_data, current_ex_data, static_cast<PID>(added_vectors)
+        );
         this->cluster_lst_.push_back(std::move(cur_cluster));
 
         added_vectors += num;
@@ -234,53 +453,98 @@ inline void IVF::init_clusters(const std::vector<size_t>& cluster_sizes) {
     }
 }
 
-inline void IVF::quantize_cluster(
-    Cluster& cp,
-    const std::vector<PID>& IDs,
-    const float* data,
-    const float* cur_centroid,
-    float* rotated_centroid,
+/**
+ * @brief Quantize all tasks (cluster id, idx of batch in the cluster) in parallel
+ *
+ * @return false if factors of any batch can not be stored in factor_type_
+ */
+template <typename TI>
+inline bool IVF::quantize_tasks(
+    const std::vector<std::pair<PID, PID>>& tasks,
+    const std::vector<std::vector<PID>>& id_lists,
+    const TI* data,
+    const std::vector<float>& rotated_centroids,
     const quant::RabitqConfig& config
-) {
-    size_t num_points = IDs.size();
-    if (cp.num() != num_points) {
-        std::cerr << "Size of cluster and IDs are inequivalent\n";
-        std::cerr << "Cluster: " << cp.num() << " IDs: " << num_points << '\n';
-        exit(1);
-    }
-
-    // copy ids
-    std::copy(IDs.begin(), IDs.end(), cp.ids());
-
-    // rotate centroid
-    this->rotator_->rotate(cur_centroid, rotated_centroid);
+) const {
+    bool in_range = true;
+#pragma omp parallel
+    {
+        BuildScratch<TI> scratch;
+        scratch.raw_data.resize(dim_ * fastscan::kBatchSize);
+        scratch.rotated_data.resize(padded_dim_ * fastscan::kBatchSize);
+        if (factor_type_ != FactorType::kFp32) {
+            scratch.fp32_batch.resize(BatchDataMap<float>::data_bytes(padded_dim_));
+        }
 
-    // rotate vectors for this cluster
-    std::vector<float> rotated_data(padded_dim_ * num_points);
-    for (size_t i = 0; i < num_points; ++i) {
-        rotator_->rotate(data + (IDs[i] * dim_), rotated_data.data() + (i * padded_dim_));
+#pragma omp for schedule(dynamic, 16) reduction(&& : in_range)
+        for (size_t t = 0; t < tasks.size(); ++t) {
+            auto [cid, batch] = tasks[t];
+            in_range = quantize_batch(
+                           cluster_lst_[cid],
+                           batch,
+                           id_lists[cid].data(),
+                           data,
+                           &rotated_centroids[cid * padded_dim_],
+                           config,
+                           scratch
+                       ) &&
+                       in_range;
+        }
     }
+    return in_range;
+}
 
-    char* batch_data = cp.batch_data();
-    char* ex_data = cp.ex_data();
-    for (size_t i = 0; i < num_points; i += fastscan::kBatchSize) {
-        size_t n = std::min(fastscan::kBatchSize, num_points - i);
-
-        quant::quantize_split_batch(
-            rotated_data.data() + (i * padded_dim_),
-            rotated_centroid,
-            n,
-            padded_dim_,
-            ex_bits_,
-            batch_data,
-            ex_data,
-            metric_type_,
-            config
+/**
+ * @brief Quantize the batch-th batch of a cluster and write codes and factors to the final
+ * location in batch_data_ and ex_data_
+ *
+ * @param ids ids of all vectors in the cluster
+ * @return false if factors can not be stored in factor_type_, see convert_batch_factors()
+ */
+template <typename TI>
+inline bool IVF::quantize_batch(
+    const Cluster& cp,
+    size_t batch,
+    const PID* ids,
+    const TI* data,
+    const float* rotated_centroid,
+    const quant::RabitqConfig& config,
+    BuildScratch<TI>& scratch
+) const {
+    size_t begin = batch * fastscan::kBatchSize;
+    size_t n = std::min(fastscan::kBatchSize, cp.num() - begin);
+    char* batch_data =
+        cp.batch_data() + (rabitqlib::batch_data_bytes(padded_dim_, factor_type_) * batch);
+    char* ex_data = cp.ex_data() + (ExDataMap<float>::data_bytes(padded_dim_, ex_bits_) * begin);
+
+    // vectors of the batch are gathered and rotated together
+    for (size_t j = 0; j < n; ++j) {
+        std::copy_n(
+            data + (ids[begin + j] * dim_), dim_, scratch.raw_data.data() + (j * dim_)
         );
-
-        batch_data += BatchDataMap<float>::data_bytes(padded_dim_);
-        ex_data += ExDataMap<float>::data_bytes(padded_dim_, ex_bits_) * n;
     }
+    rotator_->rotate_batch(scratch.raw_data.data(), n, scratch.rotated_data.data());
+    // padded lanes of the last batch stay zero as in the float layout
+    std::fill(scratch.fp32_batch.begin(), scratch.fp32_batch.end(), 0);
+
+    quant::quantize_split_batch(
+        scratch.rotated_data.data(),
+        rotated_centroid,
+        n,
+        padded_dim_,
+        ex_bits_,
+        scratch.fp32_batch.empty() ? batch_data : scratch.fp32_batch.data(),
+        ex_data,
+        metric_type_,
+        config
+    );
+    if (factor_type_ == FactorType::kFp16) {
+        return convert_batch_factors<Fp16>(scratch.fp32_batch.data(), batch_data, padded_dim_);
+    }
+    if (factor_type_ == FactorType::kBf16) {
+        return convert_batch_factors<Bf16>(scratch.fp32_batch.data(), batch_data, padded_dim_);
+    }
+    return true;
 }
 
 inline void IVF::save(const char* filename) const {
@@ -297,7 +561,12 @@ inline void IVF::save(const char* filename) const {
     output.write(reinterpret_cast<const char*>(&num_cluster_), sizeof(size_t));
     output.write(reinterpret_cast<const char*>(&ex_bits_), sizeof(size_t));
     output.write(reinterpret_cast<const char*>(&type_), sizeof(type_));
-    output.write(reinterpret_cast<const char*>(&metric_type_) ,sizeof(metric_type_));
+    // the storage type of factors shares the byte of metric type (high 4 bits), so that
+    // sizes of batches are known before loading them
+    auto metric_byte = static_cast<uint8_t>(
+        static_cast<uint8_t>(metric_type_) | (static_cast<uint8_t>(factor_type_) << 4)
+    );
+    output.write(reinterpret_cast<const char*>(&metric_byte), sizeof(metric_byte));
 
     /* Save number of vectors of each cluster */
     std::vector<size_t> cluster_sizes;
@@ -322,7 +591,13 @@ inline void IVF::save(const char* filename) const {
     output.write(
         reinterpret_cast<const char*>(ex_data_), static_cast<long>(ex_data_bytes())
     );
-    output.write(reinterpret_cast<const char*>(ids_), static_cast<long>(ids_bytes()));
+    // ids are saved uncompressed
+    std::vector<PID> ids(num_);
+    ids_.unpack(ids.data());
+    output.write(reinterpret_cast<const char*>(ids.data()), static_cast<long>(ids_bytes()));
+
+    /* Save layout of ex codes */
+    output.write(reinterpret_cast<const char*>(&ex_layout_), sizeof(ex_layout_));
 
     output.close();
 }
@@ -339,7 +614,10 @@ inline void IVF::load(const char* filename) {
     input.read(reinterpret_cast<char*>(&this->num_cluster_), sizeof(size_t));
     input.read(reinterpret_cast<char*>(&this->ex_bits_), sizeof(size_t));
     input.read(reinterpret_cast<char*>(&type_), sizeof(type_));
-    input.read(reinterpret_cast<char*>(&metric_type_), sizeof(metric_type_));
+    uint8_t metric_byte = 0;
+    input.read(reinterpret_cast<char*>(&metric_byte), sizeof(metric_byte));
+    metric_type_ = static_cast<MetricType>(metric_byte & 0xF);
+    factor_type_ = static_cast<FactorType>(metric_byte >> 4);
 
     rotator_ = choose_rotator<float>(dim_, type_, round_up_to_multiple(dim_, 64));
     padded_dim_ = rotator_->size();
@@ -367,7 +645,14 @@ inline void IVF::load(const char* filename) {
     this->initer_->load(input, filename);
     input.read(batch_data_, static_cast<long>(batch_data_bytes(cluster_sizes)));
     input.read(ex_data_, static_cast<long>(ex_data_bytes()));
-    input.read(reinterpret_cast<char*>(ids_), static_cast<long>(ids_bytes()));
+    std::vector<PID> ids(num_);
+    input.read(reinterpret_cast<char*>(ids.data()), static_cast<long>(ids_bytes()));
+    ids_.build(ids.data(), cluster_sizes);
+
+    /* Load layout of ex codes, indices saved by older versions use packed codes */
+    if (!input.read(reinterpret_cast<char*>(&ex_layout_), sizeof(ex_layout_))) {
+        ex_layout_ = ExCodeLayout::kPacked;
+    }
 
     /* Init each cluster */
     init_clusters(cluster_sizes);
@@ -376,26 +661,65 @@ inline void IVF::load(const char* filename) {
     std::cout << "Index loaded\n";
 }
 
+template <typename TI>
 inline void IVF::search(
-    const float* __restrict__ query,
+    const TI* __restrict__ query,
     size_t k,
     size_t nprobe,
     PID* __restrict__ results,
-    bool use_hacc = true
+    bool use_hacc
+) const {
+    search(query, k, nprobe, results, use_hacc ? LutMode::kHacc : LutMode::kU8);
+}
+
+/**
+ * @brief search with given precision of lookup tables
+ *
+ * @param lut_mode  LutMode::kAdaptive scans with 8-bit table and re-scans borderline
+ *                  batches with high accuracy table
+ */
+template <typename TI>
+inline void IVF::search(
+    const TI* __restrict__ query,
+    size_t k,
+    size_t nprobe,
+    PID* __restrict__ results,
+    LutMode lut_mode
+) const {
+    SearchScratch scratch;
+    search(query, k, nprobe, results, lut_mode, scratch);
+}
+
+/**
+ * @brief search with caller-provided buffers, which are reused across queries. Queries
+ * of type uint8_t, Fp16 or Bf16 are converted to float while being rotated.
+ */
+template <typename TI>
+inline void IVF::search(
+    const TI* __restrict__ query,
+    size_t k,
+    size_t nprobe,
+    PID* __restrict__ results,
+    LutMode lut_mode,
+    SearchScratch& scratch
 ) const {
     nprobe = std::min(nprobe, num_cluster_);  // corner case
-    std::vector<float> rotated_query(padded_dim_);
-    this->rotator_->rotate(query, rotated_query.data());
+    scratch.rotated_query.resize(padded_dim_);
+    const float* rotated_query = scratch.rotated_query.data();
+    this->rotator_->rotate(query, scratch.rotated_query.data());
 
     // use initer to get closest nprobe centroids
-    std::vector<AnnCandidate<float>> centroid_dist(nprobe);
-    this->initer_->centroids_distances(rotated_query.data(), nprobe, centroid_dist);
+    std::vector<AnnCandidate<float>>& centroid_dist = scratch.centroid_dist;
+    centroid_dist.resize(nprobe);
+    this->initer_->centroids_distances(rotated_query, nprobe, centroid_dist);
 
     buffer::SearchBuffer knns(k);
 
-    SplitBatchQuery<float> q_obj(
-        rotated_query.data(), padded_dim_, ex_bits_, metric_type_, use_hacc
-    );
+    SplitBatchQuery<float>& q_obj = scratch.q_obj;
+    q_obj.prepare(rotated_query, padded_dim_, ex_bits_, metric_type_, lut_mode);
+    if (int_query_ && ex_bits_ > 0 && ex_layout_ == ExCodeLayout::kPacked) {
+        q_obj.quantize_int(padded_dim_, ex_bits_);
+    }
 
     for (size_t i = 0; i < nprobe; ++i) {
         PID cid = centroid_dist[i].id;
@@ -405,7 +729,7 @@ inline void IVF::search(
         if (metric_type_ == METRIC_L2){
             q_obj.set_g_add(dist);
         }else if (metric_type_ == METRIC_IP){
-            float g_add_ip = dot_product<float>( rotated_query.data(), initer_->centroid(cid) ,padded_dim_);
+            float g_add_ip = dot_product<float>( rotated_query, initer_->centroid(cid) ,padded_dim_);
             q_obj.set_g_add(dist, g_add_ip);
         }else{
             // unsupported
@@ -413,92 +737,216 @@ inline void IVF::search(
             return;
         }
         // q_obj.set_g_add(dist);
-        search_cluster(cur_cluster, q_obj, knns, use_hacc);
+        search_cluster(cur_cluster, q_obj, knns);
     }
 
+    // ordinals of results are mapped to ids
     knns.copy_results(results);
+    ids_.decode(results, knns.size());
 }
 
 inline void IVF::search_cluster(
     const Cluster& cur_cluster,
     const SplitBatchQuery<float>& q_obj,
-    buffer::SearchBuffer<float>& knns,
-    bool use_hacc
+    buffer::SearchBuffer<float>& knns
 ) const {
-    size_t iter = cur_cluster.num() / fastscan::kBatchSize;
-    size_t remain = cur_cluster.num() - (iter * fastscan::kBatchSize);
+    constexpr size_t kWideSize = 2 * fastscan::kBatchSize;
+    size_t num = cur_cluster.num();
+    size_t batch_bytes = rabitqlib::batch_data_bytes(padded_dim_, factor_type_);
+    size_t ex_bytes = ExDataMap<float>::data_bytes(padded_dim_, ex_bits_);
 
     const char* batch_data = cur_cluster.batch_data();
     const char* ex_data = cur_cluster.ex_data();
-    const PID* ids = cur_cluster.ids();
+    PID ordinal = cur_cluster.first_ordinal();
 
-    /* Compute distances block by block */
-    for (size_t i = 0; i < iter; ++i) {
-        scan_one_batch(
-            batch_data, ex_data, ids, q_obj, knns, fastscan::kBatchSize, use_hacc
-        );
+    /* Compute distances for two adjacent batches (64 vectors) at a time */
+    size_t i = 0;
+    for (; i + kWideSize <= num; i += kWideSize) {
+        (this->*scan_wide_func_)(batch_data, ex_data, ordinal, q_obj, knns, kWideSize);
 
-        batch_data += BatchDataMap<float>::data_bytes(padded_dim_);
-        ex_data +=
-            ExDataMap<float>::data_bytes(padded_dim_, ex_bits_) * fastscan::kBatchSize;
-        ids += fastscan::kBatchSize;
+        batch_data += 2 * batch_bytes;
+        ex_data += ex_bytes * kWideSize;
+        ordinal += kWideSize;
     }
 
-    if (remain > 0) {
-        // scan the last block
-        scan_one_batch(batch_data, ex_data, ids, q_obj, knns, remain, use_hacc);
+    // scan the tail, which is a single (possibly partial) batch if it has no more than
+    // kBatchSize vectors
+    size_t remain = num - i;
+    if (remain > fastscan::kBatchSize) {
+        (this->*scan_wide_func_)(batch_data, ex_data, ordinal, q_obj, knns, remain);
+    } else if (remain > 0) {
+        (this->*scan_func_)(batch_data, ex_data, ordinal, q_obj, knns, remain);
     }
 }
 
-inline void IVF::scan_one_batch(
+template <size_t Dim, size_t ExBits, size_t NumBatch>
+RABITQ_SCAN_FLATTEN inline void IVF::scan_block(
     const char* batch_data,
     const char* ex_data,
-    const PID* ids,
+    PID first_ordinal,
     const SplitBatchQuery<float>& q_obj,
     buffer::SearchBuffer<float>& knns,
-    size_t num_points,
-    bool use_hacc
+    size_t num_points
 ) const {
-    std::array<float, fastscan::kBatchSize> est_distance;  // estimated distance
-    std::array<float, fastscan::kBatchSize> low_distance;  // lower distance
-    std::array<float, fastscan::kBatchSize> ip_x0_qr;      // inner product of the 1st bit
+    constexpr size_t kNum = NumBatch * fastscan::kBatchSize;
+    std::array<float, kNum> est_distance;  // estimated distance
+    std::array<float, kNum> low_distance;  // lower distance
+    std::array<float, kNum> ip_x0_qr;      // inner product of the 1st bit
 
-    split_batch_estdist(
+    // compile-time constants for specialized kernels, so flatten can propagate them
+    const size_t padded_dim = Dim == kAnyDim ? padded_dim_ : Dim;
+    const size_t ex_bits = ExBits == kAnyExBits ? ex_bits_ : ExBits;
+
+    float distk = knns.top_dist();
+
+    // vectors whose lower bounds are smaller than distk
+    uint64_t mask = split_batch_estmask<NumBatch>(
         batch_data,
         q_obj,
-        padded_dim_,
+        padded_dim,
+        distk,
         est_distance.data(),
         low_distance.data(),
         ip_x0_qr.data(),
-        use_hacc
+        num_points,
+        factor_type_
     );
-
-    float distk = knns.top_dist();
+    if (num_points < kNum) {
+        mask &= (1ULL << num_points) - 1;
+    }
 
     // if only use 1-bit code, directly return
-    if (ex_bits_ == 0) {
-        for (size_t i = 0; i < num_points; ++i) {
-            PID id = ids[i];
-            float ex_dist = est_distance[i];
-            knns.insert(id, ex_dist);
-            distk = knns.top_dist();
+    if (ex_bits == 0) {
+        while (mask != 0) {
+            auto i = static_cast<size_t>(__builtin_ctzll(mask));
+            mask &= mask - 1;
+            knns.insert(static_cast<PID>(first_ordinal + i), est_distance[i]);
+        }
+        return;
+    }
+
+    size_t ex_data_bytes = ExDataMap<float>::data_bytes(padded_dim, ex_bits);
+
+    // refine bit planes progressively, stop as soon as the lower bound exceeds distk
+    if (ex_layout_ == ExCodeLayout::kBitPlane) {
+        while (mask != 0) {
+            auto i = static_cast<size_t>(__builtin_ctzll(mask));
+            mask &= mask - 1;
+            if (low_distance[i] < distk) {
+                float ex_dist = split_distance_progressive(
+                    ex_data + (i * ex_data_bytes),
+                    q_obj,
+                    padded_dim,
+                    ex_bits,
+                    ip_x0_qr[i],
+                    distk
+                );
+                if (ex_dist < distk) {
+                    knns.insert(static_cast<PID>(first_ordinal + i), ex_dist);
+                    distk = knns.top_dist();
+                }
+            }
         }
         return;
     }
 
     // incremental distance computation - V2
-    for (size_t i = 0; i < num_points; ++i) {
-        float lower_dist = low_distance[i];
-        if (lower_dist < distk) {
-            PID id = ids[i];
-            ConstExDataMap<float> cur_ex(ex_data, padded_dim_, ex_bits_);
-            float ex_dist = split_distance_boosting(
-                ex_data, ip_func_, q_obj, padded_dim_, ex_bits_, ip_x0_qr[i]
+    // survivors are reranked in groups of kExIpBatch, so that the query is loaded once for
+    // the whole group. distk is refreshed after each group.
+    std::array<const char*, kExIpBatch> cand_ex_data;
+    std::array<float, kExIpBatch> cand_ip_x0_qr;
+    std::array<float, kExIpBatch> cand_dist;
+    std::array<PID, kExIpBatch> cand_ids;
+    // query quantized to integers for ex codes, see set_int_query()
+    const bool int_query = q_obj.query_i8() != nullptr || q_obj.query_i16() != nullptr;
+    const float delta_int = q_obj.delta_int();
+    while (mask != 0) {
+        size_t num_cand = 0;
+        while (mask != 0 && num_cand < kExIpBatch) {
+            auto i = static_cast<size_t>(__builtin_ctzll(mask));
+            mask &= mask - 1;
+            // distk may be updated by previous groups in this batch
+            if (low_distance[i] < distk) {
+                cand_ex_data[num_cand] = ex_data + (i * ex_data_bytes);
+                cand_ip_x0_qr[num_cand] = ip_x0_qr[i];
+                cand_ids[num_cand] = static_cast<PID>(first_ordinal + i);
+                ++num_cand;
+            }
+        }
+
+        auto boost = [&](auto ip_batch_func) {
+            split_distance_boosting_batch(
+                cand_ex_data.data(),
+                num_cand,
+                ip_batch_func,
+                q_obj,
+                padded_dim,
+                ex_bits,
+                cand_ip_x0_qr.data(),
+                cand_dist.data()
             );
-            knns.insert(id, ex_dist);
-            distk = knns.top_dist();
+        };
+        if (int_query) {
+            if constexpr (ExBits == kAnyExBits) {
+                if (const int8_t* query_i8 = q_obj.query_i8(); query_i8 != nullptr) {
+                    boost([this, query_i8, delta_int](
+                              const float*,
+                              const uint8_t* const* codes,
+                              size_t num,
+                              size_t dim,
+                              float* results
+                          ) { ip_batch_i8_func_(query_i8, delta_int, codes, num, dim, results); }
+                    );
+                } else {
+                    const int16_t* query_i16 = q_obj.query_i16();
+                    boost([this, query_i16, delta_int](
+                              const float*,
+                              const uint8_t* const* codes,
+                              size_t num,
+                              size_t dim,
+                              float* results
+                          ) {
+                        ip_batch_i16_func_(query_i16, delta_int, codes, num, dim, results);
+                    });
+                }
+            } else {
+                // see SplitBatchQuery::quantize_int()
+                constexpr bool kInt8 = ExBits <= SplitBatchQuery<float>::kMaxInt8ExBits;
+                using TQ = std::conditional_t<kInt8, int8_t, int16_t>;
+                const TQ* query_int;
+                if constexpr (kInt8) {
+                    query_int = q_obj.query_i8();
+                } else {
+                    query_int = q_obj.query_i16();
+                }
+                boost([query_int, delta_int](
+                          const float*,
+                          const uint8_t* const* codes,
+                          size_t num,
+                          size_t dim,
+                          float* results
+                      ) {
+                    excode_ip_batch_int<ExBits, TQ>(
+                        query_int, delta_int, codes, num, dim, results
+                    );
+                });
+            }
+        } else if constexpr (ExBits == kAnyExBits) {
+            boost(ip_batch_func_);
+        } else {
+            boost([](const float* query,
+                     const uint8_t* const* codes,
+                     size_t num,
+                     size_t dim,
+                     float* results) {
+                excode_ip_batch<ExBits>(query, codes, num, dim, results);
+            });
+        }
+
+        for (size_t j = 0; j < num_cand; ++j) {
+            knns.insert(cand_ids[j], cand_dist[j]);
         }
-        ex_data += ExDataMap<float>::data_bytes(padded_dim_, ex_bits_);
+        distk = knns.top_dist();
     }
 }
-}  // namespace rabitqlib::ivf
\ No newline at end of file
+}  // namespace rabitqlib::ivf
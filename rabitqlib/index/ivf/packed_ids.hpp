@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "defines.hpp"
+#include "fastscan/fastscan.hpp"
+#include "utils/tools.hpp"
+
+namespace rabitqlib::ivf {
+
+/**
+ * @brief Ids of vectors in IVF (organized by clusters), compressed by bit packing. The ids
+ * of every block of kBlockSize vectors in a cluster (aligned with FastScan batches) are
+ * stored as offsets from the smallest id of the block, using the fewest bits that hold the
+ * largest offset in the cluster. During search, vectors are identified by their ordinals in
+ * the cluster-major order, and only the final results are decoded.
+ */
+class PackedIds {
+   public:
+    static constexpr size_t kBlockSize = fastscan::kBatchSize;
+
+    PackedIds() = default;
+
+    /**
+     * @brief Compress ids of all clusters
+     *
+     * @param ids ids of vectors, cluster by cluster
+     * @param cluster_sizes num of vectors of each cluster
+     */
+    void build(const PID* ids, const std::vector<size_t>& cluster_sizes) {
+        size_t num_cluster = cluster_sizes.size();
+        cluster_offsets_.assign(num_cluster + 1, 0);
+        first_blocks_.assign(num_cluster, 0);
+        bit_offsets_.assign(num_cluster, 0);
+        widths_.assign(num_cluster, 0);
+        block_min_.clear();
+
+        size_t total_bits = 0;
+        for (size_t c = 0; c < num_cluster; ++c) {
+            const PID* cur_ids = ids + cluster_offsets_[c];
+            size_t num = cluster_sizes[c];
+            cluster_offsets_[c + 1] = static_cast<PID>(cluster_offsets_[c] + num);
+            first_blocks_[c] = block_min_.size();
+            bit_offsets_[c] = total_bits;
+
+            PID max_offset = 0;
+            for (size_t i = 0; i < num; i += kBlockSize) {
+                const PID* end = cur_ids + std::min(num, i + kBlockSize);
+                auto [lo, hi] = std::minmax_element(cur_ids + i, end);
+                block_min_.push_back(*lo);
+                max_offset = std::max(max_offset, *hi - *lo);
+            }
+            widths_[c] = static_cast<uint8_t>(
+                max_offset == 0 ? 0 : 32 - __builtin_clz(static_cast<uint32_t>(max_offset))
+            );
+            total_bits += widths_[c] * num;
+        }
+
+        // one more word, so that extract() can always read two words
+        bits_.assign(div_round_up(total_bits, 64) + 1, 0);
+        for (size_t c = 0; c < num_cluster; ++c) {
+            size_t width = widths_[c];
+            if (width == 0) {
+                continue;
+            }
+            const PID* cur_ids = ids + cluster_offsets_[c];
+            size_t num = cluster_offsets_[c + 1] - cluster_offsets_[c];
+            for (size_t i = 0; i < num; ++i) {
+                PID offset = cur_ids[i] - block_min_[first_blocks_[c] + (i / kBlockSize)];
+                size_t bit = bit_offsets_[c] + (i * width);
+                size_t shift = bit % 64;
+                bits_[bit / 64] |= static_cast<uint64_t>(offset) << shift;
+                if (shift + width > 64) {
+                    bits_[(bit / 64) + 1] |= static_cast<uint64_t>(offset) >> (64 - shift);
+                }
+            }
+        }
+    }
+
+    // id of the vector with given ordinal
+    [[nodiscard]] PID operator[](PID ordinal) const {
+        // last cluster whose 1st ordinal is not larger than ordinal (skips empty clusters)
+        size_t c = static_cast<size_t>(
+            std::upper_bound(cluster_offsets_.begin(), cluster_offsets_.end(), ordinal) -
+            cluster_offsets_.begin() - 1
+        );
+        size_t pos = ordinal - cluster_offsets_[c];
+        PID base = block_min_[first_blocks_[c] + (pos / kBlockSize)];
+        return base + extract(bit_offsets_[c] + (pos * widths_[c]), widths_[c]);
+    }
+
+    // replace ordinals by ids
+    void decode(PID* ordinals, size_t num) const {
+        for (size_t i = 0; i < num; ++i) {
+            ordinals[i] = (*this)[ordinals[i]];
+        }
+    }
+
+    // decode ids of all vectors, cluster by cluster
+    void unpack(PID* ids) const {
+        for (size_t i = 0; i < num(); ++i) {
+            ids[i] = (*this)[static_cast<PID>(i)];
+        }
+    }
+
+    [[nodiscard]] size_t num() const {
+        return cluster_offsets_.empty() ? 0 : cluster_offsets_.back();
+    }
+
+    // ordinal of the 1st vector of a cluster
+    [[nodiscard]] PID cluster_offset(size_t cluster_id) const {
+        return cluster_offsets_[cluster_id];
+    }
+
+    // memory used by the compressed ids
+    [[nodiscard]] size_t bytes() const {
+        return (sizeof(PID) * (cluster_offsets_.size() + block_min_.size())) +
+               (sizeof(size_t) * (first_blocks_.size() + bit_offsets_.size())) +
+               widths_.size() + (sizeof(uint64_t) * bits_.size());
+    }
+
+   private:
+    std::vector<PID> cluster_offsets_;  // 1st ordinal of each cluster, num_cluster + 1
+    std::vector<size_t> first_blocks_;  // index of the 1st block of each cluster
+    std::vector<size_t> bit_offsets_;   // offset (in bits) of packed ids of each cluster
+    std::vector<uint8_t> widths_;       // bits per packed id of each cluster
+    std::vector<PID> block_min_;        // smallest id of each block
+    std::vector<uint64_t> bits_;        // packed offsets
+
+    [[nodiscard]] PID extract(size_t bit, size_t width) const {
+        if (width == 0) {
+            return 0;
+        }
+        size_t word = bit / 64;
+        size_t shift = bit % 64;
+        uint64_t val = bits_[word] >> shift;
+        if (shift + width > 64) {
+            val |= bits_[word + 1] << (64 - shift);
+        }
+        return static_cast<PID>(val & ((1ULL << width) - 1));
+    }
+};
+}  // namespace rabitqlib::ivf
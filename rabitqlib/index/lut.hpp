@@ -10,6 +10,13 @@
 
 namespace rabitqlib {
 
+// precision of lookup tables for FastScan
+enum class LutMode : uint8_t {
+    kU8,       // 8-bit table
+    kHacc,     // split 16-bit table for high accuracy fastscan
+    kAdaptive  // both tables, 16-bit table is only used for borderline batches
+};
+
 template <typename T>
 class Lut {
     static constexpr size_t kNumBits = 8;
@@ -19,50 +26,89 @@ class Lut {
    private:
     size_t table_length_ = 0;
     std::vector<uint8_t> lut_;
+    std::vector<uint8_t> lut_hacc_;  // split 16-bit table, only for LutMode::kAdaptive
+    std::vector<T> lut_float_;       // float lut, kept to be reused by build()
     T delta_;
+    T delta_hacc_ = 0;
     T sum_vl_lut_;
+    T lut_error_ = 0;
 
    public:
     explicit Lut() = default;
     explicit Lut(const T* rotated_query, size_t padded_dim, bool use_hacc = false)
-        : table_length_(padded_dim << 2) // 4倍于原始维度
-        , lut_(table_length_ * (static_cast<int>(use_hacc) + 1)) {
-        // quantize float lut 将float类型的LUT量化为uint8_t类型的LUT
-        std::vector<float> lut_float(table_length_);
-        fastscan::pack_lut(padded_dim, rotated_query, lut_float.data());
+        : Lut(rotated_query, padded_dim, use_hacc ? LutMode::kHacc : LutMode::kU8) {}
+
+    explicit Lut(const T* rotated_query, size_t padded_dim, LutMode mode) {
+        build(rotated_query, padded_dim, mode);
+    }
+
+    /**
+     * @brief (Re)build the lut for a new query. Buffers of previous queries are reused, thus
+     * a Lut kept across queries of the same dimension does not allocate memory. The float lut
+     * and its range are computed in one pass, then quantized (and split for 16-bit tables)
+     * in another pass.
+     */
+    void build(const T* rotated_query, size_t padded_dim, LutMode mode) {
+        table_length_ = padded_dim << 2; // 4倍于原始维度
+        lut_.resize(table_length_ * (static_cast<int>(mode == LutMode::kHacc) + 1));
+        lut_float_.resize(table_length_);
+
         T vl_lut;  // 最小值
         T vr_lut;  // 最大值
-        data_range(lut_float.data(), table_length_, vl_lut, vr_lut);// 找到浮点查找表中的最小值和最大值
+        fastscan::pack_lut_range(
+            padded_dim, rotated_query, lut_float_.data(), vl_lut, vr_lut
+        );
 
         // 使用高精度量化方法
-        if (use_hacc) {
+        if (mode == LutMode::kHacc) {
             delta_ = (vr_lut - vl_lut) / ((1 << kNumBitsHacc) - 1);
-
-            // quantize float lut into uint16 then change to split table// 高精度：量化到16位 
-            std::vector<uint16_t> lut_u16(table_length_);
-            scalar_quantize(
-                lut_u16.data(), lut_float.data(), table_length_, vl_lut, delta_
+            fastscan::quantize_lut_hacc(
+                lut_float_.data(), padded_dim, vl_lut, delta_, lut_.data()
             );
-            fastscan::transfer_lut_hacc(lut_u16.data(), padded_dim, lut_.data());
         } else {
             // 标准精度：量化到8位
             delta_ = (vr_lut - vl_lut) / ((1 << kNumBits) - 1);
-            scalar_quantize(lut_.data(), lut_float.data(), table_length_, vl_lut, delta_);
+            scalar_quantize(lut_.data(), lut_float_.data(), table_length_, vl_lut, delta_);
         }
 
         size_t num_table = table_length_ / 16;
         sum_vl_lut_ = vl_lut * static_cast<float>(num_table);
+
+        delta_hacc_ = 0;
+        lut_error_ = 0;
+        if (mode == LutMode::kAdaptive) {
+            delta_hacc_ = (vr_lut - vl_lut) / ((1 << kNumBitsHacc) - 1);
+            lut_hacc_.resize(table_length_ * 2);
+            fastscan::quantize_lut_hacc(
+                lut_float_.data(), padded_dim, vl_lut, delta_hacc_, lut_hacc_.data()
+            );
+
+            // each entry is rounded to nearest, thus the difference between inner
+            // products accumulated by two tables is bounded by
+            lut_error_ = static_cast<T>(num_table) * (delta_ + delta_hacc_) / 2;
+        } else {
+            lut_hacc_.clear();
+        }
     }
     Lut& operator=(Lut&& other) noexcept {
+        table_length_ = other.table_length_;
         lut_ = std::move(other.lut_);
+        lut_hacc_ = std::move(other.lut_hacc_);
+        lut_float_ = std::move(other.lut_float_);
         delta_ = other.delta_;
+        delta_hacc_ = other.delta_hacc_;
         sum_vl_lut_ = other.sum_vl_lut_;
+        lut_error_ = other.lut_error_;
         return *this;
     }
 
     [[nodiscard]] const uint8_t* lut() const { return lut_.data(); };
-    [[nodiscard]] size_t lut_size_bytes() const { return lut_.size(); }  
+    [[nodiscard]] size_t lut_size_bytes() const { return lut_.size() + lut_hacc_.size(); }  
     [[nodiscard]] T delta() const { return delta_; };
     [[nodiscard]] T sum_vl() const { return sum_vl_lut_; };
+    [[nodiscard]] const uint8_t* lut_hacc() const { return lut_hacc_.data(); };
+    [[nodiscard]] T delta_hacc() const { return delta_hacc_; };
+    // max error of inner product accumulated by 8-bit table, only for LutMode::kAdaptive
+    [[nodiscard]] T lut_error() const { return lut_error_; };
 };
 }  // namespace rabitqlib
\ No newline at end of file
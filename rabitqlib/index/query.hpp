@@ -1,9 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <limits>
 #include <numeric>
 #include <utility>
+#include <vector>
 
 #include "index/lut.hpp"
 #include "quantization/rabitq.hpp"
@@ -19,9 +22,13 @@ class BatchQuery {
     Lut<T> lookup_table_;
     T G_add_ = 0;
     T G_k1xSumq_ = 0;  // G_k1xSumq
+    MetricType metric_type_ = METRIC_L2;
 
    public:
-    explicit BatchQuery(const T* rotated_query, size_t padded_dim) {
+    explicit BatchQuery(
+        const T* rotated_query, size_t padded_dim, MetricType metric_type = METRIC_L2
+    )
+        : metric_type_(metric_type) {
         lookup_table_ = std::move(Lut<T>(rotated_query, padded_dim));
 
         float c_1 = -((1 << 1) - 1) / 2.F;
@@ -40,9 +47,15 @@ class BatchQuery {
 
     [[nodiscard]] T g_add() const { return G_add_; }
 
-    void set_g_add(T sqr_norm) {
-        G_add_ = sqr_norm;
-    }  // may need to be edited if we want to support ip
+    // dist: exact distance between query and current vertex (centroid of its neighbors).
+    // For IP, dist = 1 - <q, c> and the constant 1 is already included in f_add
+    void set_g_add(T dist) {
+        if (metric_type_ == METRIC_L2) {
+            G_add_ = dist;
+        } else if (metric_type_ == METRIC_IP) {
+            G_add_ = dist - 1;
+        }
+    }
 
     [[nodiscard]] const uint8_t* lut() const { return lookup_table_.lut(); }
 };
@@ -50,15 +63,50 @@ class BatchQuery {
 template <typename T>
 class SplitBatchQuery {
    private:
-    const T* rotated_query_;
+    const T* rotated_query_ = nullptr;
     Lut<T> lookup_table_;
     T G_add_ = 0;
     T G_error_ = 0;
     T G_k1xSumq_ = 0;
     T G_kbxSumq_ = 0;
+    T sumq_pos_ = 0;  // sum of positive elements of rotated query
+    T sumq_neg_ = 0;  // sum of negative elements of rotated query
+    std::vector<int8_t> query_i8_;    // int8 rotated query, see quantize_int()
+    std::vector<int16_t> query_i16_;  // int16 rotated query, see quantize_int()
+    T delta_int_ = 0;
+
+    template <typename TQ>
+    void quantize_int_impl(size_t padded_dim, size_t ex_bits, std::vector<TQ>& query_int) {
+        // the sum of products with ex codes should not overflow int32
+        T max_int = std::min(
+            static_cast<T>(std::numeric_limits<TQ>::max()),
+            std::floor(
+                static_cast<T>(std::numeric_limits<int32_t>::max()) /
+                static_cast<T>(((1 << ex_bits) - 1) * padded_dim)
+            )
+        );
+
+        T max_abs = 0;
+        for (size_t i = 0; i < padded_dim; ++i) {
+            max_abs = std::max(max_abs, std::abs(rotated_query_[i]));
+        }
+        delta_int_ = max_abs > 0 ? max_abs / max_int : 1;
+        T one_over_delta = 1 / delta_int_;
+
+        query_int.resize(padded_dim);
+        T sum_error = 0;  // sum of (dequantized query - query)
+        for (size_t i = 0; i < padded_dim; ++i) {
+            query_int[i] = static_cast<TQ>(std::lround(rotated_query_[i] * one_over_delta));
+            sum_error += (delta_int_ * static_cast<T>(query_int[i])) - rotated_query_[i];
+        }
+        G_kbxSumq_ -= static_cast<T>((1 << ex_bits) - 1) / 2 * sum_error;
+    }
     MetricType metric_type_ = METRIC_L2;
+    LutMode lut_mode_ = LutMode::kHacc;
 
    public:
+    static constexpr size_t kMaxInt8ExBits = 3;  // max ex_bits for int8 query
+
     explicit SplitBatchQuery(
         const T* rotated_query,
         size_t padded_dim,
@@ -66,21 +114,90 @@ class SplitBatchQuery {
         MetricType metric_type = METRIC_L2,
         bool use_hacc = true
     )
-        : rotated_query_(rotated_query) {
-        lookup_table_ = std::move(Lut<T>(rotated_query, padded_dim, use_hacc));
+        : SplitBatchQuery(
+              rotated_query,
+              padded_dim,
+              ex_bits,
+              metric_type,
+              use_hacc ? LutMode::kHacc : LutMode::kU8
+          ) {}
+
+    explicit SplitBatchQuery(
+        const T* rotated_query,
+        size_t padded_dim,
+        size_t ex_bits,
+        MetricType metric_type,
+        LutMode lut_mode
+    ) {
+        prepare(rotated_query, padded_dim, ex_bits, metric_type, lut_mode);
+    }
+
+    explicit SplitBatchQuery() = default;
+
+    /**
+     * @brief (Re)initialize for a new rotated query. The lut and int query buffers of the
+     * previous query are reused, thus an object kept across queries (e.g., one per thread)
+     * prepares queries without allocating memory.
+     */
+    void prepare(
+        const T* rotated_query,
+        size_t padded_dim,
+        size_t ex_bits,
+        MetricType metric_type,
+        LutMode lut_mode
+    ) {
+        rotated_query_ = rotated_query;
+        lut_mode_ = lut_mode;
+        lookup_table_.build(rotated_query, padded_dim, lut_mode);
 
         metric_type_ = (metric_type == METRIC_IP) ? METRIC_IP : METRIC_L2;
+        G_add_ = 0;
+        G_error_ = 0;
+        query_i8_.clear();
+        query_i16_.clear();
+        delta_int_ = 0;
 
         float c_1 = -static_cast<float>((1 << 1) - 1) / 2.F;
         float c_b = -static_cast<float>((1 << (ex_bits + 1)) - 1) / 2.F;
-        T sumq =
-            std::accumulate(rotated_query, rotated_query + padded_dim, static_cast<T>(0));
+        sum_pos_neg(rotated_query, padded_dim, sumq_pos_, sumq_neg_);
+        T sumq = sumq_pos_ + sumq_neg_;
         // 计算查询向量常数项，被用于距离感估计
         G_k1xSumq_ = sumq * c_1;
         G_kbxSumq_ = sumq * c_b;
     }
     [[nodiscard]] const T* rotated_query() const { return rotated_query_; }
 
+    [[nodiscard]] T sumq_pos() const { return sumq_pos_; }
+
+    [[nodiscard]] T sumq_neg() const { return sumq_neg_; }
+
+    /**
+     * @brief Symmetrically quantize the rotated query to integers, i.e., query ~= delta *
+     * query_int, so that ip with ex codes can be computed by integer dot products. int8 is
+     * used for ex_bits <= kMaxInt8ExBits, otherwise int16 is used since the error of int8
+     * query affects the accuracy of longer ex codes. The ex codes are centered at (2^ex_bits - 1) / 2,
+     * thus the correction of the quantization error on the center is folded into kbxsumq.
+     */
+    void quantize_int(size_t padded_dim, size_t ex_bits) {
+        if (ex_bits <= kMaxInt8ExBits) {
+            quantize_int_impl(padded_dim, ex_bits, query_i8_);
+        } else {
+            quantize_int_impl(padded_dim, ex_bits, query_i16_);
+        }
+    }
+
+    // nullptr if the query is not quantized to int8
+    [[nodiscard]] const int8_t* query_i8() const {
+        return query_i8_.empty() ? nullptr : query_i8_.data();
+    }
+
+    // nullptr if the query is not quantized to int16
+    [[nodiscard]] const int16_t* query_i16() const {
+        return query_i16_.empty() ? nullptr : query_i16_.data();
+    }
+
+    [[nodiscard]] T delta_int() const { return delta_int_; }
+
     [[nodiscard]] T delta() const { return lookup_table_.delta(); }
 
     [[nodiscard]] T sum_vl_lut() const { return lookup_table_.sum_vl(); }
@@ -105,13 +222,19 @@ class SplitBatchQuery {
 
     [[nodiscard]] const uint8_t* lut() const { return lookup_table_.lut(); }
     [[nodiscard]] size_t lut_size_bytes() const { return lookup_table_.lut_size_bytes(); }  // 新增
+
+    [[nodiscard]] LutMode lut_mode() const { return lut_mode_; }
+    [[nodiscard]] const uint8_t* lut_hacc() const { return lookup_table_.lut_hacc(); }
+    [[nodiscard]] T delta_hacc() const { return lookup_table_.delta_hacc(); }
+    [[nodiscard]] T lut_error() const { return lookup_table_.lut_error(); }
 };
 
 template <typename T>
 class SplitSingleQuery {
    private:
     const T* rotated_query_;
-    std::vector<uint64_t> QueryBin_;
+    std::vector<uint64_t> QueryBin_;     // block-major, kNumBits words for each 64 dims
+    std::vector<uint64_t> QueryPlanes_;  // plane-major, padded_dim / 64 words for each bit
     T G_add_;
     T G_k1xSumq_;
     T G_kbxSumq_;
@@ -129,7 +252,9 @@ class SplitSingleQuery {
         quant::RabitqConfig config,
         size_t metric_type = METRIC_L2
     )
-        : rotated_query_(rotated_query), QueryBin_(padded_dim * kNumBits / 64, 0) {
+        : rotated_query_(rotated_query)
+        , QueryBin_(padded_dim * kNumBits / 64, 0)
+        , QueryPlanes_(padded_dim * kNumBits / 64, 0) {
         float c_1 = -static_cast<float>((1 << 1) - 1) / 2.F;
         float c_b = -static_cast<float>((1 << (ex_bits + 1)) - 1) / 2.F;
         T sumq =
@@ -151,10 +276,21 @@ class SplitSingleQuery {
         rabitqlib::new_transpose_bin(
             quant_query.data(), QueryBin_.data(), padded_dim, kNumBits
         );
+
+        // plane-major layout for warmup_ip_x0_q_planes(), which loads contiguous words of
+        // each bit plane instead of gathering them from blocks
+        size_t num_blk = padded_dim / 64;
+        for (size_t i = 0; i < num_blk; ++i) {
+            for (size_t j = 0; j < kNumBits; ++j) {
+                QueryPlanes_[(j * num_blk) + i] = QueryBin_[(i * kNumBits) + j];
+            }
+        }
     }
 
     [[nodiscard]] const uint64_t* query_bin() const { return QueryBin_.data(); }
 
+    [[nodiscard]] const uint64_t* query_planes() const { return QueryPlanes_.data(); }
+
     [[nodiscard]] const T* rotated_query() const { return rotated_query_; }
 
     [[nodiscard]] T delta() const { return delta_; }
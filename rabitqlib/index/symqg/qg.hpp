@@ -2,6 +2,7 @@
 
 #include <omp.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
@@ -25,6 +26,7 @@
 #include "utils/memory.hpp"
 #include "utils/rotator.hpp"
 #include "utils/space.hpp"
+#include "utils/tools.hpp"
 #include "utils/visited_pool.hpp"
 
 namespace rabitqlib::symqg {
@@ -35,11 +37,14 @@ class QuantizedGraph {
 
    private:
     size_t num_points_ = 0;    // num points
+    size_t capacity_ = 0;      // num of rows allocated in data_
     size_t degree_bound_ = 0;  // degree bound
     size_t dim_ = 0;           // dimension
     size_t padded_dim_ = 0;    // padded dimension
     PID entry_point_ = 0;      // Entry point of graph
     RotatorType type_ = RotatorType::FhtKacRotator;
+    MetricType metric_type_ = METRIC_L2;
+    T (*dist_func_)(const T*, const T*, size_t) = euclidean_sqr<T>;  // exact distance
 
     Array<
         char,
@@ -51,6 +56,13 @@ class QuantizedGraph {
         data_;                       // vectors + graph + quantization codes + factors
     Rotator<T>* rotator_ = nullptr;  // data rotator
     std::unique_ptr<VisitedListPool> visited_list_pool_ = nullptr;
+    VisitedSetType visited_type_ = VisitedSetType::kHashBased;  // kind of visited sets
+
+    // Seeds are a small set of vertices spread over the dataset. Their qg batch data
+    // (quantized w.r.t. zero vector) are scanned by FastScan to choose entry points.
+    std::vector<PID> seeds_;
+    std::vector<char, memory::AlignedAllocator<char>> seed_data_;
+    static constexpr size_t kNumEntries = 2;  // num of seeds used as entry points
 
     // Position of different data in each row (RawData + QuantizationCodes + Factors +
     // neighborIDs) Since we guarantee the degree for each vertex equals degree_bound
@@ -59,9 +71,15 @@ class QuantizedGraph {
     size_t neighbor_offset_ = 0;    // offset of neighbors
     size_t row_offset_ = 0;         // length of entire row
     size_t ef_ = 0;
+    size_t patience_ = 0;  // stop search if top-k not improved for patience_ expansions
+    static constexpr size_t kMinGrowRows = 1024;  // min num of rows added when data_ is full
 
     void initialize();
 
+    void init_dist_func();
+
+    void reserve(size_t);
+
     void copy_vectors(const T*);
 
     [[nodiscard]] T* get_vector(PID data_id) {
@@ -92,19 +110,24 @@ class QuantizedGraph {
     }
 
     void
-    find_candidates(PID, size_t, std::vector<AnnCandidate<T>>&, HashBasedBooleanSet&, const std::vector<uint32_t>&)
+    find_candidates(PID, size_t, std::vector<AnnCandidate<T>>&, VisitedSet&, const std::vector<uint32_t>&)
         const;
 
     void update_qg(PID, const std::vector<AnnCandidate<T>>&);
 
-    void update_results(buffer::SearchBuffer<T>&, HashBasedBooleanSet&, const T*);
+    void init_search_pool(BatchQuery<T>&, const T*, buffer::SearchBuffer<T>&) const;
+
+    size_t select_neighbors(const std::vector<AnnCandidate<T>>&, std::vector<AnnCandidate<T>>&)
+        const;
+
+    void update_results(buffer::SearchBuffer<T>&, VisitedSet&, const T*);
 
     void scan_neighbors(
         const BatchQuery<T>&,
         PID,
         T*,
         buffer::SearchBuffer<T>&,
-        HashBasedBooleanSet&,
+        VisitedSet&,
         size_t
     ) const;
 
@@ -113,7 +136,8 @@ class QuantizedGraph {
         size_t num,
         size_t dim,
         size_t max_deg,
-        RotatorType type = RotatorType::FhtKacRotator
+        RotatorType type = RotatorType::FhtKacRotator,
+        MetricType metric_type = METRIC_L2
     );
 
     explicit QuantizedGraph() = default;
@@ -128,23 +152,43 @@ class QuantizedGraph {
 
     [[nodiscard]] auto entry_point() const { return this->entry_point_; }
 
+    [[nodiscard]] auto metric_type() const { return this->metric_type_; }
+
     void set_ep(PID entry) { this->entry_point_ = entry; };
 
+    void set_seeds(const std::vector<PID>&);
+
+    [[nodiscard]] const auto& seeds() const { return this->seeds_; }
+
     void save(const char*) const;
 
     void load(const char*);
 
     void set_ef(size_t);
 
+    void set_early_stop(size_t);
+
+    void set_visited_set(VisitedSetType);
+
+    [[nodiscard]] auto visited_set_type() const { return this->visited_type_; }
+
+    /* insert a new vertex into the graph and return its id */
+    PID insert(const T* __restrict__ vec, size_t ef_build = 200);
+
     /* search and copy results to KNN */
     void search(const T* __restrict__ query, uint32_t knn, uint32_t* __restrict__ results);
 };
 
 template <typename T>
 inline QuantizedGraph<T>::QuantizedGraph(
-    size_t num, size_t dim, size_t max_deg, RotatorType type
+    size_t num, size_t dim, size_t max_deg, RotatorType type, MetricType metric_type
 )
-    : num_points_(num), degree_bound_(max_deg), dim_(dim), padded_dim_(dim), type_(type) {
+    : num_points_(num)
+    , degree_bound_(max_deg)
+    , dim_(dim)
+    , padded_dim_(dim)
+    , type_(type)
+    , metric_type_(metric_type) {
     // choose rotator
 
     initialize();
@@ -180,12 +224,22 @@ inline void QuantizedGraph<T>::save(const char* filename) const {
     output.write(reinterpret_cast<const char*>(&entry_point_), sizeof(PID));
     output.write(reinterpret_cast<const char*>(&type_), sizeof(RotatorType));
 
-    /* Data */
-    data_.save(output);
+    /* Data, only rows in use are saved since data_ may be over-allocated by insert() */
+    output.write(data_.data(), static_cast<long>(row_offset_ * num_points_));
 
     /* Rotator */
     this->rotator_->save(output);
 
+    /* Seeds */
+    size_t num_seeds = seeds_.size();
+    output.write(reinterpret_cast<const char*>(&num_seeds), sizeof(size_t));
+    output.write(
+        reinterpret_cast<const char*>(seeds_.data()), static_cast<long>(sizeof(PID) * num_seeds)
+    );
+
+    /* Metric, appended after seeds so that indices saved before it still load */
+    output.write(reinterpret_cast<const char*>(&metric_type_), sizeof(MetricType));
+
     output.close();
     std::cout << "\tQuantized graph saved!\n";
 }
@@ -223,6 +277,22 @@ inline void QuantizedGraph<T>::load(const char* filename) {
         exit(1);
     }
 
+    /* Seeds, index without seeds only uses the entry point */
+    size_t num_seeds = 0;
+    input.read(reinterpret_cast<char*>(&num_seeds), sizeof(size_t));
+    std::vector<PID> seeds(input ? num_seeds : 0);
+    input.read(reinterpret_cast<char*>(seeds.data()), static_cast<long>(sizeof(PID) * seeds.size()));
+
+    /* Metric, index without metric is built with L2 */
+    metric_type_ = METRIC_L2;
+    input.read(reinterpret_cast<char*>(&metric_type_), sizeof(MetricType));
+    if (!input) {
+        metric_type_ = METRIC_L2;
+    }
+    init_dist_func();
+
+    set_seeds(seeds);
+
     input.close();
     std::cout << "Quantized graph loaded!\n";
 }
@@ -230,6 +300,29 @@ inline void QuantizedGraph<T>::load(const char* filename) {
 template <typename T>
 inline void QuantizedGraph<T>::set_ef(size_t cur_ef) {
     this->ef_ = cur_ef;
+    // each expansion visits one vertex, most searches expand less than 2 * ef vertices
+    visited_list_pool_->set_capacity(2 * ef_);
+}
+
+/**
+ * @brief choose the kind of visited sets used by search and insert
+ */
+template <typename T>
+inline void QuantizedGraph<T>::set_visited_set(VisitedSetType type) {
+    this->visited_type_ = type;
+    visited_list_pool_ =
+        std::make_unique<VisitedListPool>(1, capacity_, visited_type_, 2 * ef_);
+}
+
+/**
+ * @brief adaptive early termination for search. The search stops once the top-k results
+ * are not improved for patience consecutive expansions, ef still bounds the search pool.
+ *
+ * @param patience  num of expansions without improvement, 0 disables early termination
+ */
+template <typename T>
+inline void QuantizedGraph<T>::set_early_stop(size_t patience) {
+    this->patience_ = patience;
 }
 
 /**
@@ -247,16 +340,17 @@ inline void QuantizedGraph<T>::search(
     rotator_->rotate(query, rotated_query.data());
 
     // init query
-    BatchQuery<T> q_obj(rotated_query.data(), padded_dim_);
+    BatchQuery<T> q_obj(rotated_query.data(), padded_dim_, metric_type_);
 
     buffer::SearchBuffer<T> search_pool(ef_);
     // init search buffer
-    search_pool.insert(this->entry_point_, std::numeric_limits<T>::max());
+    init_search_pool(q_obj, query, search_pool);
 
     buffer::SearchBuffer res_pool(k);  // result buffer
     auto* vis = visited_list_pool_->get_free_vislist();
 
     std::vector<T> est_dist(degree_bound_);  // estimated distances
+    size_t num_stale = 0;                     // num of expansions without improvement
 
     while (search_pool.has_next()) {
         PID cur_node = search_pool.pop();
@@ -265,12 +359,18 @@ inline void QuantizedGraph<T>::search(
         }
         vis->set(cur_node);
 
-        q_obj.set_g_add(euclidean_sqr(query, get_vector(cur_node), dim_));
+        T cur_dist = dist_func_(query, get_vector(cur_node), dim_);
+        q_obj.set_g_add(cur_dist);
 
         scan_neighbors(
             q_obj, cur_node, est_dist.data(), search_pool, *vis, this->degree_bound_
         );
-        res_pool.insert(cur_node, q_obj.g_add());
+        num_stale = cur_dist < res_pool.top_dist() ? 0 : num_stale + 1;
+        res_pool.insert(cur_node, cur_dist);
+
+        if (patience_ > 0 && num_stale >= patience_) {
+            break;
+        }
     }
 
     update_results(res_pool, *vis, query);
@@ -286,7 +386,7 @@ void QuantizedGraph<T>::scan_neighbors(
     PID data_id,
     T* est_dist,
     buffer::SearchBuffer<T>& search_pool,
-    HashBasedBooleanSet& vis,
+    VisitedSet& vis,
     size_t cur_degree
 ) const {
     const auto* batch_data = get_batch_data(data_id);
@@ -312,7 +412,7 @@ void QuantizedGraph<T>::scan_neighbors(
 
 template <typename T>
 inline void QuantizedGraph<T>::update_results(
-    buffer::SearchBuffer<T>& result_pool, HashBasedBooleanSet& vis, const T* query
+    buffer::SearchBuffer<T>& result_pool, VisitedSet& vis, const T* query
 ) {
     if (result_pool.is_full()) {
         return;
@@ -326,7 +426,7 @@ inline void QuantizedGraph<T>::update_results(
             if (!vis.get(cur_neighbor)) {
                 vis.set(cur_neighbor);
                 result_pool.insert(
-                    cur_neighbor, euclidean_sqr(query, get_vector(cur_neighbor), dim_)
+                    cur_neighbor, dist_func_(query, get_vector(cur_neighbor), dim_)
                 );
             }
         }
@@ -336,6 +436,19 @@ inline void QuantizedGraph<T>::update_results(
     }
 }
 
+// choose exact distance function by metric
+template <typename T>
+inline void QuantizedGraph<T>::init_dist_func() {
+    if (metric_type_ == METRIC_L2) {
+        dist_func_ = euclidean_sqr<T>;
+    } else if (metric_type_ == METRIC_IP) {
+        dist_func_ = dot_product_dis<T>;
+    } else {
+        std::cerr << "Unsupported metric type for QuantizedGraph\n";
+        exit(1);
+    }
+}
+
 // initialize const offsets & data array
 template <typename T>
 inline void QuantizedGraph<T>::initialize() {
@@ -344,6 +457,8 @@ inline void QuantizedGraph<T>::initialize() {
     rotator_ = choose_rotator<float>(dim_, type_, round_up_to_multiple(dim_, 64));
     padded_dim_ = rotator_->size();
 
+    init_dist_func();
+
     /* check size */
     assert(padded_dim_ % 64 == 0);
     assert(padded_dim_ >= dim_);
@@ -357,8 +472,85 @@ inline void QuantizedGraph<T>::initialize() {
     data_ = Array<char, std::vector<size_t>, memory::AlignedAllocator<char, 1 << 22, true>>(
         std::vector<size_t>{num_points_, row_offset_}
     );
+    capacity_ = num_points_;
 
-    visited_list_pool_ = std::make_unique<VisitedListPool>(1, num_points_);
+    visited_list_pool_ =
+        std::make_unique<VisitedListPool>(1, num_points_, visited_type_, 2 * ef_);
+}
+
+// enlarge data_ to hold new_capacity rows, rows in use are kept
+template <typename T>
+inline void QuantizedGraph<T>::reserve(size_t new_capacity) {
+    if (new_capacity <= capacity_) {
+        return;
+    }
+    decltype(data_) new_data(std::vector<size_t>{new_capacity, row_offset_});
+    std::copy(data_.data(), data_.data() + (row_offset_ * num_points_), new_data.data());
+    data_ = std::move(new_data);
+    capacity_ = new_capacity;
+    // visited sets are sized by num of rows
+    visited_list_pool_ =
+        std::make_unique<VisitedListPool>(1, capacity_, visited_type_, 2 * ef_);
+}
+
+/**
+ * @brief set seeds for choosing entry points, vectors of seeds should be ready
+ *
+ * @param seeds     ids of seeds, empty means only the entry point is used
+ */
+template <typename T>
+inline void QuantizedGraph<T>::set_seeds(const std::vector<PID>& seeds) {
+    seeds_ = seeds;
+    size_t num_blocks = div_round_up(seeds_.size(), fastscan::kBatchSize);
+    seed_data_.assign(num_blocks * QGBatchDataMap<T>::data_bytes(padded_dim_), 0);
+
+    std::vector<T> raw_data(fastscan::kBatchSize * dim_);
+    std::vector<T> rotated_data(fastscan::kBatchSize * padded_dim_);
+    auto* batch_data = seed_data_.data();
+    for (size_t i = 0; i < seeds_.size(); i += fastscan::kBatchSize) {
+        size_t num = std::min(seeds_.size() - i, fastscan::kBatchSize);
+        for (size_t j = 0; j < num; ++j) {
+            std::copy_n(get_vector(seeds_[i + j]), dim_, &raw_data[j * dim_]);
+        }
+        this->rotator_->rotate_batch(raw_data.data(), num, rotated_data.data());
+        quant::quantize_qg_batch(
+            rotated_data.data(), num, padded_dim_, batch_data, metric_type_
+        );
+        batch_data += QGBatchDataMap<T>::data_bytes(padded_dim_);
+    }
+}
+
+// insert entry points into search pool, use the nearest seeds if there are seeds
+template <typename T>
+inline void QuantizedGraph<T>::init_search_pool(
+    BatchQuery<T>& q_obj, const T* query, buffer::SearchBuffer<T>& search_pool
+) const {
+    if (seeds_.empty()) {
+        search_pool.insert(this->entry_point_, std::numeric_limits<T>::max());
+        return;
+    }
+
+    // distance between query and zero vector, which is the centroid of seed codes
+    q_obj.set_g_add(metric_type_ == METRIC_L2 ? l2norm_sqr(query, dim_) : 1);
+
+    std::vector<T> est_dist(fastscan::kBatchSize);
+    buffer::SearchBuffer<T> entries(kNumEntries);
+    const auto* batch_data = seed_data_.data();
+    for (size_t i = 0; i < seeds_.size(); i += fastscan::kBatchSize) {
+        qg_batch_estdist(batch_data, q_obj, padded_dim_, est_dist.data());
+        size_t num = std::min(seeds_.size() - i, fastscan::kBatchSize);
+        for (size_t j = 0; j < num; ++j) {
+            if (!entries.is_full(est_dist[j])) {
+                entries.insert(seeds_[i + j], est_dist[j]);
+            }
+        }
+        batch_data += QGBatchDataMap<T>::data_bytes(padded_dim_);
+    }
+
+    while (entries.has_next()) {
+        T dist = entries.next_dist();
+        search_pool.insert(entries.pop(), dist);
+    }
 }
 
 // find candidate neighbors for cur_id, exclude the vertex itself
@@ -367,7 +559,7 @@ inline void QuantizedGraph<T>::find_candidates(
     PID cur_id,
     size_t search_ef,
     std::vector<AnnCandidate<T>>& results,
-    HashBasedBooleanSet& vis,
+    VisitedSet& vis,
     const std::vector<uint32_t>& degrees
 ) const {
     const T* query = get_vector(cur_id);
@@ -375,14 +567,12 @@ inline void QuantizedGraph<T>::find_candidates(
     rotator_->rotate(query, rotated_query.data());
 
     // init query
-    BatchQuery<T> q_obj(rotated_query.data(), padded_dim_);
+    BatchQuery<T> q_obj(rotated_query.data(), padded_dim_, metric_type_);
 
-    // insert entry point to initialize search buffer
+    // insert entry points to initialize search buffer
     buffer::SearchBuffer tmp_pool(search_ef);
-    tmp_pool.insert(this->entry_point_, 1e10);
-    memory::mem_prefetch_l1(
-        reinterpret_cast<const char*>(get_vector(this->entry_point_)), 10
-    );
+    init_search_pool(q_obj, query, tmp_pool);
+    memory::mem_prefetch_l1(reinterpret_cast<const char*>(get_vector(tmp_pool.next_id())), 10);
 
     /* Current version of fast scan compute 32 distances */
     std::vector<T> est_dist(degree_bound_);  // estimated distances
@@ -392,11 +582,13 @@ inline void QuantizedGraph<T>::find_candidates(
             continue;
         }
         vis.set(cur_candi);
-        auto cur_degree = degrees[cur_candi];
-        q_obj.set_g_add(euclidean_sqr(query, get_vector(cur_candi), dim_));
+        // empty degrees means every vertex already has degree_bound_ neighbors
+        auto cur_degree = degrees.empty() ? degree_bound_ : degrees[cur_candi];
+        T cur_dist = dist_func_(query, get_vector(cur_candi), dim_);
+        q_obj.set_g_add(cur_dist);
         scan_neighbors(q_obj, cur_candi, est_dist.data(), tmp_pool, vis, cur_degree);
         if (cur_candi != cur_id) {
-            results.emplace_back(cur_candi, q_obj.g_add());
+            results.emplace_back(cur_candi, cur_dist);
         }
     }
 }
@@ -417,14 +609,15 @@ inline void QuantizedGraph<T>::update_qg(
         neighbor_ptr[i] = new_neighbors[i].id;
     }
 
-    // rotated data
-    std::vector<T> rotated_data(cur_degree * padded_dim_);
-    std::vector<T> rotated_centroid(padded_dim_);
+    // rotated data, neighbors and the current vertex (last row) are rotated in one batch
+    std::vector<T> raw_data((cur_degree + 1) * dim_);
+    std::vector<T> rotated_data((cur_degree + 1) * padded_dim_);
     for (size_t i = 0; i < cur_degree; ++i) {
-        const T* neighbor_vec = get_vector(new_neighbors[i].id);
-        this->rotator_->rotate(neighbor_vec, &rotated_data[i * padded_dim_]);
+        std::copy_n(get_vector(new_neighbors[i].id), dim_, &raw_data[i * dim_]);
     }
-    this->rotator_->rotate(get_vector(cur_id), rotated_centroid.data());
+    std::copy_n(get_vector(cur_id), dim_, &raw_data[cur_degree * dim_]);
+    this->rotator_->rotate_batch(raw_data.data(), cur_degree + 1, rotated_data.data());
+    const T* rotated_centroid = &rotated_data[cur_degree * padded_dim_];
 
     // quantize batches for current vertex
     auto* batch_data = get_batch_data(cur_id);
@@ -432,14 +625,135 @@ inline void QuantizedGraph<T>::update_qg(
     for (size_t i = 0; i < cur_degree; i += fastscan::kBatchSize) {
         quant::quantize_qg_batch(
             data,
-            rotated_centroid.data(),
+            rotated_centroid,
             std::min(cur_degree - i, fastscan::kBatchSize),
             padded_dim_,
-            batch_data
+            batch_data,
+            metric_type_
         );
 
         data += fastscan::kBatchSize * padded_dim_;
         batch_data += QGBatchDataMap<T>::data_bytes(padded_dim_);
     }
 }
+
+/**
+ * @brief select degree_bound_ neighbors from a sorted candidate pool. Candidates are
+ * pruned with the same rule as QGBuilder::heuristic_prune, then the nearest pruned
+ * candidates are used to fill the list so that the degree still equals degree_bound_.
+ *
+ * @return num of neighbors kept by pruning, they are placed at the front of results
+ */
+template <typename T>
+inline size_t QuantizedGraph<T>::select_neighbors(
+    const std::vector<AnnCandidate<T>>& pool, std::vector<AnnCandidate<T>>& results
+) const {
+    results.clear();
+    size_t poolsize = pool.size();
+    std::vector<bool> pruned(poolsize, false);
+
+    // i : current vertex
+    // j : neighbor added in this iter
+    // k : remained unpruned candidate neighbor
+    for (size_t start = 0; start < poolsize && results.size() < degree_bound_; ++start) {
+        if (pruned[start]) {
+            continue;
+        }
+        results.emplace_back(pool[start]);
+        const T* data_j = get_vector(pool[start].id);
+        for (size_t k = start + 1; k < poolsize; ++k) {
+            if (!pruned[k] &&
+                dist_func_(data_j, get_vector(pool[k].id), dim_) < pool[k].distance) {
+                pruned[k] = true;
+            }
+        }
+    }
+    size_t num_selected = results.size();
+
+    for (size_t k = 0; k < poolsize && results.size() < degree_bound_; ++k) {
+        if (pruned[k]) {
+            results.emplace_back(pool[k]);
+        }
+    }
+
+    return num_selected;
+}
+
+/**
+ * @brief insert a new vertex into the graph. Neighbors of the new vertex are found by
+ * searching the current graph, then the new vertex is linked back from the neighbors that
+ * keep it after pruning. Only rows whose neighbor lists changed are re-quantized. This
+ * function is not thread-safe and should not run concurrently with search.
+ *
+ * @param vec       unrotated vector, dimension_ elements
+ * @param ef_build  size of search pool for finding neighbors
+ * @return PID      id of the new vertex
+ */
+template <typename T>
+inline PID QuantizedGraph<T>::insert(const T* __restrict__ vec, size_t ef_build) {
+    if (num_points_ <= degree_bound_) {
+        std::cerr << "Not enough vertices in QuantizedGraph for insertion\n";
+        exit(1);
+    }
+
+    if (num_points_ == capacity_) {
+        reserve(capacity_ + std::max(kMinGrowRows, capacity_ / 8));
+    }
+
+    PID cur_id = static_cast<PID>(num_points_);
+    std::copy(vec, vec + dim_, get_vector(cur_id));
+
+    // the new vertex has no in-edges yet, thus it will not be visited by the search
+    std::vector<AnnCandidate<T>> candidates;
+    auto* vis = visited_list_pool_->get_free_vislist();
+    find_candidates(cur_id, std::max(ef_build, degree_bound_), candidates, *vis, {});
+    visited_list_pool_->release_vis_list(vis);
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<AnnCandidate<T>> neighbors;
+    neighbors.reserve(degree_bound_);
+    size_t num_selected = select_neighbors(candidates, neighbors);
+
+    // if the vertex still doesn't have enough neighbors, use random vertices
+    while (neighbors.size() < degree_bound_) {
+        PID rand_id = rand_integer<PID>(0, cur_id - 1);
+        if (std::none_of(neighbors.begin(), neighbors.end(), [&](const auto& nei) {
+                return nei.id == rand_id;
+            })) {
+            neighbors.emplace_back(rand_id, dist_func_(vec, get_vector(rand_id), dim_));
+        }
+    }
+
+    update_qg(cur_id, neighbors);
+    ++num_points_;
+
+    // add reverse edges, the farthest pruned neighbor is replaced if the new vertex is kept
+    std::vector<AnnCandidate<T>> pool;
+    std::vector<AnnCandidate<T>> new_neighbors;
+    pool.reserve(degree_bound_ + 1);
+    new_neighbors.reserve(degree_bound_);
+    for (size_t i = 0; i < num_selected; ++i) {
+        PID dst = neighbors[i].id;
+        const T* dst_data = get_vector(dst);
+        const PID* dst_neighbors = get_neighbors(dst);
+
+        pool.clear();
+        for (size_t j = 0; j < degree_bound_; ++j) {
+            pool.emplace_back(
+                dst_neighbors[j], dist_func_(dst_data, get_vector(dst_neighbors[j]), dim_)
+            );
+        }
+        pool.emplace_back(cur_id, neighbors[i].distance);
+        std::sort(pool.begin(), pool.end());
+
+        select_neighbors(pool, new_neighbors);
+        if (std::any_of(new_neighbors.begin(), new_neighbors.end(), [&](const auto& nei) {
+                return nei.id == cur_id;
+            })) {
+            update_qg(dst, new_neighbors);
+        }
+    }
+
+    return cur_id;
+}
 }  // namespace rabitqlib::symqg
@@ -11,8 +11,8 @@
 
 #include "defines.hpp"
 #include "index/symqg/qg.hpp"
-#include "utils/hashset.hpp"
 #include "utils/tools.hpp"
+#include "utils/visited_pool.hpp"
 
 namespace rabitqlib::symqg {
 constexpr size_t kMaxBsIter = 5;  // max iter for binary search of pruning bar
@@ -35,12 +35,15 @@ class QGBuilder {
         750;  // max num of candidates for indexing
     static constexpr size_t kMaxPrunedSize =
         300;  // max number of recorded pruned candidates
+    static constexpr size_t kSamplesPerSeed = 64;  // num of samples per seed for k-means
+    static constexpr size_t kKmeansIter = 10;      // num of iterations for k-means
     float (*dist_func_)(const float*, const float*, size_t);
     std::vector<CandidateList> new_neighbors_;       // new neighbors for current iteration
     std::vector<CandidateList> pruned_neighbors_;    // recorded pruned neighbors
-    std::vector<HashBasedBooleanSet> visited_list_;  // list of visited hash set
+    std::vector<VisitedSet> visited_list_;  // list of visited hash set
     std::vector<uint32_t> degrees_;                  // record degree of qg
     void random_init();
+    std::vector<PID> select_seeds(const float*, size_t) const;
     void search_new_neighbors(bool refine);
     void heuristic_prune(PID, CandidateList&, CandidateList&, bool);
     void add_reverse_edges(bool);
@@ -55,7 +58,8 @@ class QGBuilder {
         QuantizedGraph<float>& index,
         uint32_t ef_build,
         const float* data,
-        size_t num_threads = std::numeric_limits<size_t>::max()
+        size_t num_threads = std::numeric_limits<size_t>::max(),
+        size_t num_seeds = 64
     )
         : qg_{index}
         , ef_build_{ef_build}
@@ -63,12 +67,19 @@ class QGBuilder {
         , num_nodes_{qg_.num_vertices()}
         , dim_{qg_.dimension()}
         , degree_bound_(qg_.degree_bound())
-        , dist_func_{euclidean_sqr<float>}
+        , dist_func_{
+              (qg_.metric_type() == METRIC_IP) ? dot_product_dis<float>
+                                               : euclidean_sqr<float>
+          }
         , new_neighbors_(qg_.num_vertices())
         , pruned_neighbors_(qg_.num_vertices())
         , visited_list_(
               num_threads_,
-              HashBasedBooleanSet(std::min(ef_build_ * ef_build_, num_nodes_ / 10))
+              VisitedSet(
+                  qg_.visited_set_type(),
+                  std::min(ef_build_ * ef_build_, num_nodes_ / 10),
+                  num_nodes_
+              )
           )
         , degrees_(qg_.num_vertices(), degree_bound_) {
         omp_set_num_threads(static_cast<int>(num_threads_));
@@ -83,6 +94,7 @@ class QGBuilder {
 
         qg_.set_ep(entry_point);
         qg_.copy_vectors(data);
+        qg_.set_seeds(select_seeds(data, num_seeds));
 
         random_init();
     }
@@ -236,7 +248,7 @@ inline void QGBuilder::search_new_neighbors(bool refine) {
         PID cur_id = i;
         auto tid = omp_get_thread_num();
         CandidateList candidates;
-        HashBasedBooleanSet& vis = visited_list_[tid];
+        VisitedSet& vis = visited_list_[tid];
         candidates.reserve(2 * kMaxCandidatePoolSize);
         vis.clear();
         qg_.find_candidates(cur_id, ef_build_, candidates, vis, degrees_);
@@ -305,6 +317,96 @@ inline void QGBuilder::add_reverse_edges(bool refine) {
     }
 }
 
+/**
+ * @brief select seeds for choosing entry points in search. We run k-means on a sample of
+ * data and use the nearest sampled vertex to each centroid as a seed.
+ *
+ * @param num_seeds  num of seeds, 0 means only the entry point is used
+ */
+inline std::vector<PID> QGBuilder::select_seeds(const float* data, size_t num_seeds) const {
+    num_seeds = std::min(num_seeds, num_nodes_);
+    if (num_seeds == 0) {
+        return {};
+    }
+
+    size_t num_samples = std::min(num_nodes_, num_seeds * kSamplesPerSeed);
+    std::vector<PID> samples(num_samples);
+    for (size_t i = 0; i < num_samples; ++i) {
+        samples[i] = static_cast<PID>(i * num_nodes_ / num_samples);
+    }
+
+    // init centroids with evenly spaced samples
+    std::vector<float> centroids(num_seeds * dim_);
+    for (size_t i = 0; i < num_seeds; ++i) {
+        const float* src = data + (samples[i * num_samples / num_seeds] * dim_);
+        std::copy(src, src + dim_, &centroids[i * dim_]);
+    }
+
+    std::vector<PID> assignments(num_samples);
+    auto nearest_centroid = [&](const float* vec) {
+        PID nearest = 0;
+        float min_dist = std::numeric_limits<float>::max();
+        for (size_t j = 0; j < num_seeds; ++j) {
+            float dist = euclidean_sqr(vec, &centroids[j * dim_], dim_);
+            if (dist < min_dist) {
+                min_dist = dist;
+                nearest = static_cast<PID>(j);
+            }
+        }
+        return nearest;
+    };
+
+    for (size_t iter = 0; iter < kKmeansIter; ++iter) {
+#pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < num_samples; ++i) {
+            assignments[i] = nearest_centroid(data + (samples[i] * dim_));
+        }
+
+        std::vector<float> sums(num_seeds * dim_, 0);
+        std::vector<size_t> counts(num_seeds, 0);
+        for (size_t i = 0; i < num_samples; ++i) {
+            const float* vec = data + (samples[i] * dim_);
+            float* sum = &sums[assignments[i] * dim_];
+            for (size_t j = 0; j < dim_; ++j) {
+                sum[j] += vec[j];
+            }
+            ++counts[assignments[i]];
+        }
+        // keep the old centroid for empty clusters
+        for (size_t i = 0; i < num_seeds; ++i) {
+            if (counts[i] == 0) {
+                continue;
+            }
+            for (size_t j = 0; j < dim_; ++j) {
+                centroids[(i * dim_) + j] = sums[(i * dim_) + j] / static_cast<float>(counts[i]);
+            }
+        }
+    }
+
+    // nearest sampled vertex to each centroid
+    std::vector<PID> nearest(num_seeds);
+    std::vector<float> min_dists(num_seeds, std::numeric_limits<float>::max());
+    for (size_t i = 0; i < num_samples; ++i) {
+        PID cluster = assignments[i];
+        float dist = euclidean_sqr(data + (samples[i] * dim_), &centroids[cluster * dim_], dim_);
+        if (dist < min_dists[cluster]) {
+            min_dists[cluster] = dist;
+            nearest[cluster] = samples[i];
+        }
+    }
+
+    std::vector<PID> seeds;
+    seeds.reserve(num_seeds);
+    for (size_t i = 0; i < num_seeds; ++i) {
+        if (min_dists[i] < std::numeric_limits<float>::max()) {
+            seeds.push_back(nearest[i]);
+        }
+    }
+
+    std::cout << "Selected " << seeds.size() << " seeds for entry points\n";
+    return seeds;
+}
+
 inline void QGBuilder::random_init() {
     const PID min_id = 0;
     const PID max_id = num_nodes_ - 1;
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <iostream>
 
+#include "defines.hpp"
 #include "fastscan/fastscan.hpp"
+#include "utils/half.hpp"
 
 namespace rabitqlib {
 template <typename T>
@@ -54,6 +59,51 @@ struct ConstBatchDataMap {
     const T* f_error_;
 };
 
+// bytes of a batch whose factors are stored in factor_type
+inline size_t batch_data_bytes(size_t padded_dim, FactorType factor_type) {
+    switch (factor_type) {
+        case FactorType::kFp32:
+            return BatchDataMap<float>::data_bytes(padded_dim);
+        case FactorType::kFp16:
+            return BatchDataMap<Fp16>::data_bytes(padded_dim);
+        case FactorType::kBf16:
+            return BatchDataMap<Bf16>::data_bytes(padded_dim);
+    }
+    std::cerr << "Invalid factor type in batch_data_bytes()\n";
+    exit(1);
+}
+
+/**
+ * @brief Convert a batch with float factors (src) into a batch whose factors are stored in
+ * T (dst). f_add and f_rescale are rounded to nearest, f_error is rounded up.
+ *
+ * @return false if any factor exceeds kMax of T, dst is incomplete then. Subnormal values
+ * are kept, their rounding error is covered by the estimator, see batch_estmask().
+ */
+template <typename T>
+inline bool convert_batch_factors(const char* src, char* dst, size_t padded_dim) {
+    ConstBatchDataMap<float> src_batch(src, padded_dim);
+    BatchDataMap<T> dst_batch(dst, padded_dim);
+    std::memcpy(
+        dst_batch.bin_code(), src_batch.bin_code(), padded_dim * fastscan::kBatchSize / 8
+    );
+    auto too_large = [](float val) {
+        return std::isfinite(val) && std::abs(val) > HalfTraits<T>::kMax;
+    };
+    for (size_t i = 0; i < fastscan::kBatchSize; ++i) {
+        float f_add = src_batch.f_add()[i];
+        float f_rescale = src_batch.f_rescale()[i];
+        float f_error = src_batch.f_error()[i];
+        if (too_large(f_add) || too_large(f_rescale) || too_large(f_error)) {
+            return false;
+        }
+        dst_batch.f_add()[i] = from_float<T>(f_add);
+        dst_batch.f_rescale()[i] = from_float<T>(f_rescale);
+        dst_batch.f_error()[i] = from_float_up<T>(f_error);
+    }
+    return true;
+}
+
 template <typename T>
 struct QGBatchDataMap {
    public:
@@ -8,6 +8,7 @@
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <vector>
 
 namespace rabitqlib::quant::rabitq_impl::ex_bits {
 inline void packing_1bit_excode(const uint8_t* o_raw, uint8_t* o_compact, size_t dim) {
@@ -295,4 +296,20 @@ inline void packing_rabitqplus_code(
         exit(1);
     }
 }
+
+// store ex codes as ex_bits planes from the most significant bit, each plane is packed as a
+// 1-bit ex code. The total size is the same as packing_rabitqplus_code().
+inline void packing_bitplane_excode(
+    const uint8_t* o_raw, uint8_t* o_compact, size_t dim, size_t ex_bits
+) {
+    std::vector<uint8_t> plane(dim);
+    for (size_t p = 0; p < ex_bits; ++p) {
+        size_t shift = ex_bits - 1 - p;
+        for (size_t i = 0; i < dim; ++i) {
+            plane[i] = (o_raw[i] >> shift) & 1;
+        }
+        packing_1bit_excode(plane.data(), o_compact, dim);
+        o_compact += dim / 8;
+    }
+}
 }  // namespace rabitqlib::quant::rabitq_impl::ex_bits
\ No newline at end of file
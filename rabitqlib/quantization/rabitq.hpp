@@ -2,6 +2,7 @@
 
 #include <omp.h>
 
+#include <array>
 #include <cmath>
 #include <cstddef>
 #include <vector>
@@ -15,6 +16,7 @@ namespace rabitqlib::quant {
 
 struct RabitqConfig {
     double t_const = -1;
+    ExCodeLayout ex_layout = ExCodeLayout::kPacked;  // layout of ex codes
     explicit RabitqConfig() = default;
     RabitqConfig(RabitqConfig const&) = default;
     RabitqConfig(RabitqConfig&&) = default;
@@ -65,12 +67,11 @@ inline void quantize_one_batch(
     char* batch_data,
     MetricType metric_type = METRIC_L2
 ) {
-    std::vector<T> centroid(padded_dim, 0);
     BatchDataMap<T> this_batch(batch_data, padded_dim);
 
-    rabitq_impl::one_bit::one_bit_batch_code(
+    rabitq_impl::one_bit::one_bit_batch_code<T>(
         data,
-        centroid.data(),
+        nullptr,  // zero centroid
         num,
         padded_dim,
         this_batch.bin_code(),
@@ -90,7 +91,7 @@ static inline void quantize_qg_batch(
     char* batch_data,
     MetricType metric_type = METRIC_L2
 ) {
-    std::vector<T> f_error(fastscan::kBatchSize);  // we dont need this factor for qg
+    std::array<T, fastscan::kBatchSize> f_error;  // we dont need this factor for qg
     QGBatchDataMap<T> cur_batch(batch_data, padded_dim);
 
     rabitq_impl::one_bit::one_bit_batch_code<T>(
@@ -114,13 +115,12 @@ static inline void quantize_qg_batch(
     char* batch_data,
     MetricType metric_type = METRIC_L2
 ) {
-    std::vector<T> centroid(padded_dim, 0);
-    std::vector<T> f_error(fastscan::kBatchSize);  // we dont need this factor for qg
+    std::array<T, fastscan::kBatchSize> f_error;  // we dont need this factor for qg
     QGBatchDataMap<T> cur_batch(batch_data, padded_dim);
 
     rabitq_impl::one_bit::one_bit_batch_code<T>(
         data,
-        centroid.data(),
+        nullptr,  // zero centroid
         num,
         padded_dim,
         cur_batch.bin_code(),
@@ -179,10 +179,9 @@ inline void quantize_compact_one_bit(
     T& ferror,
     MetricType metric_type = METRIC_L2
 ) {
-    std::vector<T> centroid(padded_dim, 0);
-    rabitq_impl::one_bit::one_bit_compact_code(
+    rabitq_impl::one_bit::one_bit_compact_code<T>(
         data,
-        centroid.data(),
+        nullptr,  // zero centroid
         padded_dim,
         compact_code,
         f_add,
@@ -217,7 +216,8 @@ inline void quantize_compact_ex_bits(
         cur_ex_data.f_rescale_ex(),
         ex_error,
         metric_type,
-        config.t_const
+        config.t_const,
+        config.ex_layout
     );
 }
 
@@ -3,15 +3,20 @@
 #include <immintrin.h>
 #include <omp.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
 #include "defines.hpp"
 #include "fastscan/fastscan.hpp"
 #include "quantization/pack_excode.hpp"
 #include "utils/space.hpp"
+#include "utils/tools.hpp"
 
 namespace rabitqlib::quant::rabitq_impl {
 
@@ -53,69 +58,203 @@ inline RowMajorArray<T> one_bit_code(
     return residual_arr;
 }
 
+namespace fused_impl {
+// bit i of byte becomes bit (7 - i), i.e., the 1st dim goes to the most significant bit
+inline uint8_t reverse_bits(uint32_t byte) {
+    byte = ((byte & 0xF0U) >> 4) | ((byte & 0x0FU) << 4);
+    byte = ((byte & 0xCCU) >> 2) | ((byte & 0x33U) << 2);
+    byte = ((byte & 0xAAU) >> 1) | ((byte & 0x55U) << 1);
+    return static_cast<uint8_t>(byte);
+}
+
+#if !defined(__AVX512F__)
+inline double reduce_add_m256d(__m256d vec) {
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(vec), _mm256_extractf128_pd(vec, 1));
+    sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+    return _mm_cvtsd_f64(sum);
+}
+#endif
+
+// sums over all dims needed by the factors, r = data - centroid, c = centroid. Sums are
+// accumulated in double, since ip_resi_cent and cent_signed may cancel out to near 0.
+struct OneBitSums {
+    double l2_sqr = 0;        // <r, r>
+    double abs_sum = 0;       // sum of |r|
+    double cent_signed = 0;   // sum of c where r > 0 minus sum of c where r <= 0
+    double ip_resi_cent = 0;  // <r, c>
+};
+
+template <typename T, typename Emit>
+inline void scalar_pass(
+    const T* data, const T* centroid, size_t begin, size_t dim, Emit& emit, OneBitSums& sums
+) {
+    for (size_t i = begin; i < dim; i += 8) {
+        uint32_t byte = 0;
+        for (size_t j = i; j < std::min(i + 8, dim); ++j) {
+            T cent = centroid == nullptr ? 0 : centroid[j];
+            auto res = static_cast<double>(data[j] - cent);
+            bool pos = res > 0;
+            byte |= static_cast<uint32_t>(pos) << (7 - (j - i));
+            sums.l2_sqr += res * res;
+            sums.abs_sum += std::abs(res);
+            sums.cent_signed += pos ? cent : -cent;
+            sums.ip_resi_cent += res * cent;
+        }
+        emit(i / 8, static_cast<uint8_t>(byte));
+    }
+}
+
+#if defined(__AVX512F__)
+// accumulate 8 dims of residual and centroid (in double) into the sums
+inline void add_sums_x8(
+    __m512d res,
+    __m512d cent,
+    __mmask8 pos,
+    __m512d& l2_sqr,
+    __m512d& abs_sum,
+    __m512d& cent_signed,
+    __m512d& ip_resi_cent
+) {
+    l2_sqr = _mm512_fmadd_pd(res, res, l2_sqr);
+    abs_sum = _mm512_add_pd(abs_sum, _mm512_abs_pd(res));
+    cent_signed = _mm512_mask_add_pd(cent_signed, pos, cent_signed, cent);
+    cent_signed =
+        _mm512_mask_sub_pd(cent_signed, static_cast<__mmask8>(~pos), cent_signed, cent);
+    ip_resi_cent = _mm512_fmadd_pd(res, cent, ip_resi_cent);
+}
+#endif
+
 /**
- * @brief The one_bit_code_with_factor function maps a data vector to a binary code and
- * computes factors for distance estimation.
- *
- * @param data Input data vector to be quantized
- * @param centroid Input center vector used as reference for quantization
- * @param dim Dimensionality of the vectors
- * @param binary_code Output binary code where each element is 0 or 1 based on whether
- *                    the corresponding residual element (data - centroid) is positive
- * @param f_add Output factor used in distance estimation to add to the final result
- * @param f_rescale Output scaling factor used in distance estimation
- * @param f_error Output error bound for the distance estimation
- * @param metric_type Type of distance metric to use (L2 or inner product)
+ * @brief One pass over the vector: residual, sign code and all sums for the factors.
+ * emit(i, byte) receives the i-th byte (8 dims, 1st dim in the most significant bit) of
+ * the binary code. centroid can be nullptr for a zero centroid. The residual is computed in
+ * T as before, products and sums are computed in double.
+ */
+template <typename T, typename Emit>
+inline OneBitSums one_bit_pass(const T* data, const T* centroid, size_t dim, Emit& emit) {
+    OneBitSums sums;
+    size_t i = 0;
+    if constexpr (std::is_same_v<T, float>) {
+#if defined(__AVX512F__)
+        __m512d l2_sqr = _mm512_setzero_pd();
+        __m512d abs_sum = _mm512_setzero_pd();
+        __m512d cent_signed = _mm512_setzero_pd();
+        __m512d ip_resi_cent = _mm512_setzero_pd();
+        auto hi_half = [](__m512 vec) {
+            return _mm256_castsi256_ps(
+                _mm512_extracti64x4_epi64(_mm512_castps_si512(vec), 1)
+            );
+        };
+        for (; i + 16 <= dim; i += 16) {
+            __m512 cent =
+                centroid == nullptr ? _mm512_setzero_ps() : _mm512_loadu_ps(&centroid[i]);
+            __m512 res = _mm512_sub_ps(_mm512_loadu_ps(&data[i]), cent);
+            __mmask16 pos = _mm512_cmp_ps_mask(res, _mm512_setzero_ps(), _CMP_GT_OQ);
+            add_sums_x8(
+                _mm512_cvtps_pd(_mm512_castps512_ps256(res)),
+                _mm512_cvtps_pd(_mm512_castps512_ps256(cent)),
+                static_cast<__mmask8>(pos & 0xFFU),
+                l2_sqr,
+                abs_sum,
+                cent_signed,
+                ip_resi_cent
+            );
+            add_sums_x8(
+                _mm512_cvtps_pd(hi_half(res)),
+                _mm512_cvtps_pd(hi_half(cent)),
+                static_cast<__mmask8>(pos >> 8),
+                l2_sqr,
+                abs_sum,
+                cent_signed,
+                ip_resi_cent
+            );
+            emit(i / 8, reverse_bits(pos & 0xFFU));
+            emit((i / 8) + 1, reverse_bits(static_cast<uint32_t>(pos) >> 8));
+        }
+        sums.l2_sqr = _mm512_reduce_add_pd(l2_sqr);
+        sums.abs_sum = _mm512_reduce_add_pd(abs_sum);
+        sums.cent_signed = _mm512_reduce_add_pd(cent_signed);
+        sums.ip_resi_cent = _mm512_reduce_add_pd(ip_resi_cent);
+#else
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        __m256d l2_sqr = _mm256_setzero_pd();
+        __m256d abs_sum = _mm256_setzero_pd();
+        __m256d cent_signed = _mm256_setzero_pd();
+        __m256d ip_resi_cent = _mm256_setzero_pd();
+        for (; i + 8 <= dim; i += 8) {
+            __m256 cent =
+                centroid == nullptr ? _mm256_setzero_ps() : _mm256_loadu_ps(&centroid[i]);
+            __m256 res = _mm256_sub_ps(_mm256_loadu_ps(&data[i]), cent);
+            __m256 pos = _mm256_cmp_ps(res, _mm256_setzero_ps(), _CMP_GT_OQ);
+            for (size_t h = 0; h < 2; ++h) {
+                __m256d res_d = _mm256_cvtps_pd(
+                    h == 0 ? _mm256_castps256_ps128(res) : _mm256_extractf128_ps(res, 1)
+                );
+                __m256d cent_d = _mm256_cvtps_pd(
+                    h == 0 ? _mm256_castps256_ps128(cent) : _mm256_extractf128_ps(cent, 1)
+                );
+                __m256d pos_d = _mm256_cmp_pd(res_d, _mm256_setzero_pd(), _CMP_GT_OQ);
+                l2_sqr = _mm256_fmadd_pd(res_d, res_d, l2_sqr);
+                abs_sum = _mm256_add_pd(abs_sum, _mm256_andnot_pd(sign, res_d));
+                // c where r > 0, -c otherwise
+                cent_signed = _mm256_add_pd(
+                    cent_signed, _mm256_xor_pd(cent_d, _mm256_andnot_pd(pos_d, sign))
+                );
+                ip_resi_cent = _mm256_fmadd_pd(res_d, cent_d, ip_resi_cent);
+            }
+            emit(i / 8, reverse_bits(static_cast<uint32_t>(_mm256_movemask_ps(pos))));
+        }
+        sums.l2_sqr = reduce_add_m256d(l2_sqr);
+        sums.abs_sum = reduce_add_m256d(abs_sum);
+        sums.cent_signed = reduce_add_m256d(cent_signed);
+        sums.ip_resi_cent = reduce_add_m256d(ip_resi_cent);
+#endif
+    }
+    scalar_pass(data, centroid, i, dim, emit, sums);
+    return sums;
+}
+}  // namespace fused_impl
+
+/**
+ * @brief Compute factors for distance estimation from the sums of one_bit_pass().
  *
- * This function computes a binary code by recording the sign of every coordinate
- * in the residual vector (data - centroid) and calculates the necessary factors
- * for accurate distance estimation. The factors are used in the estimator to
- * approximate distances between the original vectors.
+ * Let xu_cb = x_u + cb (cb = -0.5), which has same direction and different length with
+ * x_bar. Every coordinate of xu_cb is +-0.5 with the sign of the residual, thus
+ * <residual, xu_cb> = sum(|residual|) / 2, <centroid, xu_cb> = cent_signed / 2 and
+ * <xu_cb, xu_cb> = dim / 4. Factors are computed in double and rounded to T at the end.
  */
 template <typename T>
-inline void one_bit_code_with_factor(
-    const T* data,
-    const T* centroid,
+inline void one_bit_factors(
+    const fused_impl::OneBitSums& sums,
     size_t dim,
-    int* binary_code,
     T& f_add,
     T& f_rescale,
     T& f_error,
-    MetricType metric_type = METRIC_L2
+    MetricType metric_type
 ) {
-    // quantize
-    RowMajorArray<T> residual_arr = one_bit_code(data, centroid, dim, binary_code);
-
-    // xu_cb = x_u + cb, xu_cb has same direction and different length with x_bar
-    // 计算输入向量与聚类中心的差值，对残差向量的每个维度，如果 > 0 则编码为1，否则为0
-    float cb = -((1 << 1) - 1) / 2.F;
-    RowMajorArrayMap<int> x_u(binary_code, 1, static_cast<long>(dim));
-    RowMajorArray<T> xu_cb = x_u.template cast<T>() + cb;
-
     // distance to centroid
-    T l2_sqr = l2norm_sqr<T>(residual_arr.data(), dim);
-    T l2_norm = std::sqrt(l2_sqr);
+    double l2_sqr = sums.l2_sqr;
+    double l2_norm = std::sqrt(l2_sqr);
 
     // dot product between residual and xu_cb
-    T ip_resi_xucb = dot_product<T>(residual_arr.data(), xu_cb.data(), dim);
+    double ip_resi_xucb = sums.abs_sum / 2;
     // dot product between centroid and xu_cb
-    T ip_cent_xucb = dot_product<T>(centroid, xu_cb.data(), dim);
+    double ip_cent_xucb = sums.cent_signed / 2;
+    double xucb_sqr = static_cast<double>(dim) / 4;
 
     // corner case
     if (ip_resi_xucb == 0) {
-        ip_resi_xucb = std::numeric_limits<T>::infinity();
+        ip_resi_xucb = std::numeric_limits<double>::infinity();
     }
 
     // We use unnormalized vector to get error factor. To be more specific,
     // sqrt((1 - <o, o_bar>^2) / <o, o_bar>^2) / sqrt(dim - 1) = 3rd item in following
     // expression
-    T tmp_error =
-        l2_norm * kConstEpsilon *
-        std::sqrt(
-            (((l2_sqr * l2norm_sqr<T>(xu_cb.data(), dim)) / (ip_resi_xucb * ip_resi_xucb)) -
-             1) /
-            (dim - 1)
-        );
+    double tmp_error = l2_norm * kConstEpsilon *
+                       std::sqrt(
+                           (((l2_sqr * xucb_sqr) / (ip_resi_xucb * ip_resi_xucb)) - 1) /
+                           static_cast<double>(dim - 1)
+                       );
 
     // 3 factors used for distance estimation, please refer to document for more info.
     // For f_rescale and 2nd item of f_add, we use the dot product of raw residual (rather
@@ -123,15 +262,14 @@ inline void one_bit_code_with_factor(
     // For (ip_cent_xucb / ip_resi_xucb), the norm of xucb does not matter since it is also
     // in numerator.
     if (metric_type == METRIC_L2) {
-        // // 计算用于距离估计的因子
-        f_add = l2_sqr + 2 * l2_sqr * ip_cent_xucb / ip_resi_xucb;
-        f_rescale = -2 * l2_sqr / ip_resi_xucb;
-        f_error = 2 * tmp_error;
+        f_add = static_cast<T>(l2_sqr + 2 * l2_sqr * ip_cent_xucb / ip_resi_xucb);
+        f_rescale = static_cast<T>(-2 * l2_sqr / ip_resi_xucb);
+        f_error = static_cast<T>(2 * tmp_error);
     } else if (metric_type == METRIC_IP) {
-        f_add = 1 - dot_product<T>(residual_arr.data(), centroid, dim) +
-                l2_sqr * ip_cent_xucb / ip_resi_xucb;
-        f_rescale = -l2_sqr / ip_resi_xucb;
-        f_error = 1 * tmp_error;
+        f_add =
+            static_cast<T>(1 - sums.ip_resi_cent + (l2_sqr * ip_cent_xucb / ip_resi_xucb));
+        f_rescale = static_cast<T>(-l2_sqr / ip_resi_xucb);
+        f_error = static_cast<T>(1 * tmp_error);
     } else {
         std::cerr << "Unsupported metric type in quantization\n" << std::flush;
         exit(1);
@@ -139,11 +277,51 @@ inline void one_bit_code_with_factor(
 }
 
 /**
- * @brief The one_bit_compact_code function maps a data vector to a compact binary code and
+ * @brief The one_bit_code_with_factor function maps a data vector to a binary code and
  * computes factors for distance estimation.
  *
  * @param data Input data vector to be quantized
  * @param centroid Input center vector used as reference for quantization
+ * @param dim Dimensionality of the vectors
+ * @param binary_code Output binary code where each element is 0 or 1 based on whether
+ *                    the corresponding residual element (data - centroid) is positive
+ * @param f_add Output factor used in distance estimation to add to the final result
+ * @param f_rescale Output scaling factor used in distance estimation
+ * @param f_error Output error bound for the distance estimation
+ * @param metric_type Type of distance metric to use (L2 or inner product)
+ *
+ * This function computes a binary code by recording the sign of every coordinate
+ * in the residual vector (data - centroid) and calculates the necessary factors
+ * for accurate distance estimation. The factors are used in the estimator to
+ * approximate distances between the original vectors.
+ */
+template <typename T>
+inline void one_bit_code_with_factor(
+    const T* data,
+    const T* centroid,
+    size_t dim,
+    int* binary_code,
+    T& f_add,
+    T& f_rescale,
+    T& f_error,
+    MetricType metric_type = METRIC_L2
+) {
+    auto emit = [&](size_t i, uint8_t byte) {
+        for (size_t j = i * 8; j < std::min((i + 1) * 8, dim); ++j) {
+            binary_code[j] = (byte >> (7 - (j - (i * 8)))) & 1;
+        }
+    };
+    auto sums = fused_impl::one_bit_pass(data, centroid, dim, emit);
+    one_bit_factors(sums, dim, f_add, f_rescale, f_error, metric_type);
+}
+
+/**
+ * @brief The one_bit_compact_code function maps a data vector to a compact binary code and
+ * computes factors for distance estimation.
+ *
+ * @param data Input data vector to be quantized
+ * @param centroid Input center vector used as reference for quantization, nullptr for a
+ * zero centroid
  * @param padded_dim Dimensionality of the vectors (padded to a multiple of the bit-packing
  * size)
  * @param compact_code Output compact binary code where the binary values are packed into
@@ -156,8 +334,8 @@ inline void one_bit_code_with_factor(
  * This function computes a compact binary code by recording the sign of every coordinate
  * in the residual vector (data - centroid) and packs the binary values into integers
  * for efficient storage and computation. It also calculates the necessary factors
- * for accurate distance estimation. The factors are used in the estimator to
- * approximate distances between the original vectors.
+ * for accurate distance estimation. Codes are packed in the same pass that computes the
+ * residual and the factors, so no memory is allocated.
  */
 template <typename T, typename TC>
 inline void one_bit_compact_code(
@@ -170,22 +348,17 @@ inline void one_bit_compact_code(
     T& f_error,
     MetricType metric_type = METRIC_L2
 ) {
-    // binary code
-    std::vector<int> binary_code(padded_dim);
-
-    // get binary code
-    one_bit_code_with_factor(
-        data,
-        centroid,
-        padded_dim,
-        binary_code.data(),
-        f_add,
-        f_recale,
-        f_error,
-        metric_type
-    );
-
-    pack_binary(binary_code.data(), compact_code, padded_dim);
+    // bytes arrive in order, every sizeof(TC) of them make one integer
+    TC cur = 0;
+    auto emit = [&](size_t i, uint8_t byte) {
+        cur = static_cast<TC>((static_cast<uint64_t>(cur) << 8) | byte);
+        if ((i + 1) % sizeof(TC) == 0) {
+            compact_code[i / sizeof(TC)] = cur;
+            cur = 0;
+        }
+    };
+    auto sums = fused_impl::one_bit_pass(data, centroid, padded_dim, emit);
+    one_bit_factors(sums, padded_dim, f_add, f_recale, f_error, metric_type);
 }
 
 // ! padded_dim % 64 == 0
@@ -218,8 +391,14 @@ inline void one_bit_compact_codes(
     }
 }
 
+/**
+ * @brief Quantize num vectors into FastScan batches. Each vector is quantized in one pass
+ * and its code bytes are packed into the batch layout right away (see
+ * fastscan::pack_code_byte()), so no intermediate codes are buffered or allocated.
+ * centroid can be nullptr for a zero centroid.
+ */
 // ! padded_dim % 64 == 0
-template <typename T, bool Parallel = false>
+template <typename T>
 inline void one_bit_batch_code(
     const T* data,
     const T* centroid,
@@ -231,20 +410,18 @@ inline void one_bit_batch_code(
     T* f_error,
     MetricType metric_type = METRIC_L2
 ) {
-    std::vector<uint8_t> compact_codes(num * padded_dim / 8);
+    size_t batch_bytes = padded_dim / 8 * fastscan::kBatchSize;
+    std::memset(packed_code, 0, div_round_up(num, fastscan::kBatchSize) * batch_bytes);
 
-    one_bit_compact_codes<T, uint8_t, Parallel>(
-        data,
-        centroid,
-        num,
-        padded_dim,
-        compact_codes.data(),
-        f_add,
-        f_recale,
-        f_error,
-        metric_type
-    );
-    fastscan::pack_codes(padded_dim, compact_codes.data(), num, packed_code);
+    for (size_t i = 0; i < num; ++i) {
+        uint8_t* block = packed_code + (i / fastscan::kBatchSize * batch_bytes);
+        size_t id = i % fastscan::kBatchSize;
+        auto emit = [&](size_t col, uint8_t byte) {
+            fastscan::pack_code_byte(byte, col, id, block);
+        };
+        auto sums = fused_impl::one_bit_pass(data + (padded_dim * i), centroid, padded_dim, emit);
+        one_bit_factors(sums, padded_dim, f_add[i], f_recale[i], f_error[i], metric_type);
+    }
 }
 
 }  // namespace one_bit
@@ -274,60 +451,146 @@ constexpr std::array<float, 9> kTightStart = {
     0.81,
 };
 
+namespace rescale_impl {
+// the code of vector id becomes code at rescale factor t
+struct RescaleEvent {
+    double t;
+    uint32_t id;
+    uint32_t code;
+};
+
+// buffers reused by best_rescale_factor() of the same thread
+struct RescaleScratch {
+    std::vector<RescaleEvent> events;
+    std::vector<RescaleEvent> sorted;
+    std::vector<uint32_t> bucket_start;
+};
+
+inline RescaleScratch& rescale_scratch() {
+    static thread_local RescaleScratch scratch;
+    return scratch;
+}
+
+inline bool event_less(const RescaleEvent& a, const RescaleEvent& b) {
+    return a.t < b.t || (a.t == b.t && a.id < b.id);
+}
+}  // namespace rescale_impl
+
+/**
+ * @brief Find the rescale factor t in [t_start, t_end) that maximizes the cosine between
+ * o_abs and its code (floor(t * o_abs) + 0.5). The code of a dimension only changes when t
+ * passes an event (code + 1) / o_abs[i], thus we sweep all events in ascending order of
+ * (t, i). Events are generated once and sorted by a bucketed counting sort (buckets are
+ * tiny since events are spread uniformly in t), so no priority queue or per call
+ * allocation is needed.
+ */
 template <typename T>
 inline double best_rescale_factor(const T* o_abs, size_t dim, size_t ex_bits) {
     constexpr double kEps = 1e-5;
     constexpr int kNEnum = 10;
+    constexpr size_t kEventsPerBucket = 2;
+    const int max_code = (1 << ex_bits) - 1;
     double max_o = *std::max_element(o_abs, o_abs + dim);
 
-    double t_end = static_cast<double>(((1 << ex_bits) - 1) + kNEnum) / max_o;
+    double t_end = static_cast<double>(max_code + kNEnum) / max_o;
     double t_start = t_end * kTightStart[ex_bits];
 
-    std::vector<int> cur_o_bar(dim);
     double sqr_denominator = static_cast<double>(dim) * 0.25;
     double numerator = 0;
 
+    auto& scratch = rescale_impl::rescale_scratch();
+    auto& events = scratch.events;
+    events.clear();
+
     for (size_t i = 0; i < dim; ++i) {
-        int cur = static_cast<int>((t_start * o_abs[i]) + kEps);
-        cur_o_bar[i] = cur;
+        double o = o_abs[i];
+        int cur = static_cast<int>((t_start * o) + kEps);
         sqr_denominator += cur * cur + cur;
-        numerator += (cur + 0.5) * o_abs[i];
+        numerator += (cur + 0.5) * o;
+
+        // code never changes for 0
+        if (o <= 0) {
+            continue;
+        }
+        // the 1st event is always included, then following ones before t_end while the
+        // code is smaller than max_code
+        auto id = static_cast<uint32_t>(i);
+        int code = cur + 1;
+        events.push_back({static_cast<double>(code) / o, id, static_cast<uint32_t>(code)});
+        for (++code; code <= max_code; ++code) {
+            double t = static_cast<double>(code) / o;
+            if (!(t < t_end)) {
+                break;
+            }
+            events.push_back({t, id, static_cast<uint32_t>(code)});
+        }
+    }
+    if (events.empty()) {
+        return 0;
     }
 
-    std::priority_queue<
-        std::pair<double, size_t>,
-        std::vector<std::pair<double, size_t>>,
-        std::greater<>>
-        next_t;
+    // bucketed counting sort by t, events beyond t_end (only 1st events) share the last
+    // bucket
+    size_t num_events = events.size();
+    size_t num_buckets = std::max<size_t>(1, num_events / kEventsPerBucket);
+    double t_lo = t_start;
+    double bucket_scale = static_cast<double>(num_buckets) / (t_end - t_start);
+    auto bucket_of = [&](double t) {
+        double pos = (t - t_lo) * bucket_scale;
+        return pos < static_cast<double>(num_buckets - 1)
+                   ? static_cast<size_t>(std::max(pos, 0.0))
+                   : num_buckets - 1;
+    };
+
+    auto& bucket_start = scratch.bucket_start;
+    bucket_start.assign(num_buckets + 1, 0);
+    for (const auto& event : events) {
+        ++bucket_start[bucket_of(event.t) + 1];
+    }
+    for (size_t b = 0; b < num_buckets; ++b) {
+        bucket_start[b + 1] += bucket_start[b];
+    }
+    auto& sorted = scratch.sorted;
+    sorted.resize(num_events);
+    for (const auto& event : events) {
+        sorted[bucket_start[bucket_of(event.t)]++] = event;
+    }
 
-    for (size_t i = 0; i < dim; ++i) {
-        next_t.emplace(static_cast<double>(cur_o_bar[i] + 1) / o_abs[i], i);
+    // bucket_start[b] is now the end of bucket b, sort events inside each bucket. The last
+    // bucket also collects all events beyond t_end, which may be many if lots of o_abs are
+    // close to 0, thus it is sorted by std::sort instead of insertion sort.
+    size_t begin = 0;
+    for (size_t b = 0; b < num_buckets; ++b) {
+        size_t end = bucket_start[b];
+        if (b == num_buckets - 1) {
+            std::sort(
+                sorted.begin() + static_cast<long>(begin),
+                sorted.begin() + static_cast<long>(end),
+                rescale_impl::event_less
+            );
+            break;
+        }
+        for (size_t i = begin + 1; i < end; ++i) {
+            rescale_impl::RescaleEvent cur = sorted[i];
+            size_t j = i;
+            for (; j > begin && rescale_impl::event_less(cur, sorted[j - 1]); --j) {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = cur;
+        }
+        begin = end;
     }
 
     double max_ip = 0;
     double t = 0;
-
-    while (!next_t.empty()) {
-        double cur_t = next_t.top().first;
-        size_t update_id = next_t.top().second;
-        next_t.pop();
-
-        cur_o_bar[update_id]++;
-        int update_o_bar = cur_o_bar[update_id];
-        sqr_denominator += 2 * update_o_bar;
-        numerator += o_abs[update_id];
+    for (const auto& event : sorted) {
+        sqr_denominator += 2 * static_cast<double>(event.code);
+        numerator += o_abs[event.id];
 
         double cur_ip = numerator / std::sqrt(sqr_denominator);
         if (cur_ip > max_ip) {
             max_ip = cur_ip;
-            t = cur_t;
-        }
-
-        if (update_o_bar < (1 << ex_bits) - 1) {
-            double t_next = static_cast<double>(update_o_bar + 1) / o_abs[update_id];
-            if (t_next < t_end) {
-                next_t.emplace(t_next, update_id);
-            }
+            t = event.t;
         }
     }
 
@@ -340,17 +603,13 @@ inline T quantize_ex(const T* o_abs, TP* code, size_t dim, size_t ex_bits) {
     double t = best_rescale_factor<T>(o_abs, dim, ex_bits);
     double ipnorm = 0;
 
-    std::vector<int> tmp_code(dim);
     for (size_t i = 0; i < dim; i++) {
         // compute and store code
-        tmp_code[i] = static_cast<int>((t * o_abs[i]) + kEps);
-        if (tmp_code[i] >= (1 << ex_bits)) {
-            tmp_code[i] = (1 << ex_bits) - 1;
-        }
-        code[i] = static_cast<TP>(tmp_code[i]);
+        int cur_code = std::min(static_cast<int>((t * o_abs[i]) + kEps), (1 << ex_bits) - 1);
+        code[i] = static_cast<TP>(cur_code);
 
         // ip * norm = unnormalized ip
-        ipnorm += (tmp_code[i] + 0.5) * o_abs[i];
+        ipnorm += (cur_code + 0.5) * o_abs[i];
     }
 
     T ipnorm_inv = static_cast<double>(1 / ipnorm);  // 1 / (ip*norm)
@@ -476,7 +735,7 @@ inline void ex_bits_code_with_factor(
 
     // corner case
     if (ip_resi_xucb == 0) {
-        ip_resi_xucb = std::numeric_limits<T>::infinity();
+        ip_resi_xucb = std::numeric_limits<double>::infinity();
     }
 
     T tmp_error =
@@ -513,7 +772,8 @@ inline void ex_bits_compact_code(
     T& f_rescale_ex,
     T& f_error_ex,
     MetricType metric_type = METRIC_L2,
-    double t_const = -1
+    double t_const = -1,
+    ExCodeLayout layout = ExCodeLayout::kPacked
 ) {
     std::vector<uint8_t> ex_code(padded_dim);
 
@@ -530,7 +790,11 @@ inline void ex_bits_compact_code(
         t_const
     );
 
-    packing_rabitqplus_code(ex_code.data(), compact_code, padded_dim, ex_bits);
+    if (layout == ExCodeLayout::kBitPlane) {
+        packing_bitplane_excode(ex_code.data(), compact_code, padded_dim, ex_bits);
+    } else {
+        packing_rabitqplus_code(ex_code.data(), compact_code, padded_dim, ex_bits);
+    }
 }
 }  // namespace ex_bits
 
@@ -75,6 +75,9 @@ class SearchBuffer {
     // return candidate id for next pop()
     [[nodiscard]] auto next_id() const { return data_[cur_].id; }
 
+    // return candidate distance for next pop()
+    [[nodiscard]] auto next_dist() const { return data_[cur_].distance; }
+
     [[nodiscard]] auto has_next() const -> bool { return cur_ < size_; }
 
     void resize(size_t new_size) {
@@ -84,6 +87,9 @@ class SearchBuffer {
         );
     }
 
+    // num of candidates in the buffer
+    [[nodiscard]] size_t size() const { return size_; }
+
     void copy_results(PID* knn) const {
         for (size_t i = 0; i < size_; ++i) {
             knn[i] = data_[i].id;
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <immintrin.h>
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace rabitqlib {
+
+// 16-bit storage types for floats, see FactorType in defines.hpp
+struct Fp16 {
+    uint16_t bits;
+};
+
+struct Bf16 {
+    uint16_t bits;
+};
+
+// raw 16-bit data (e.g., loaded as uint16_t) can be viewed as Fp16 / Bf16
+static_assert(sizeof(Fp16) == sizeof(uint16_t) && sizeof(Bf16) == sizeof(uint16_t));
+
+namespace half_impl {
+inline uint32_t float_bits(float val) {
+    uint32_t bits;
+    std::memcpy(&bits, &val, sizeof(bits));
+    return bits;
+}
+
+inline float bits_float(uint32_t bits) {
+    float val;
+    std::memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+}  // namespace half_impl
+
+/**
+ * @brief Traits of the storage types of factors. kUnitRoundoff bounds the relative error of
+ * rounding a float to the nearest value of the type for values in [kMinNormal, kMax], the
+ * error of smaller (subnormal) values is bounded by kUnitRoundoff * kMinNormal. kMinNormal
+ * is the smallest normal value, kMax is the largest finite value.
+ */
+template <typename T>
+struct HalfTraits;
+
+template <>
+struct HalfTraits<float> {
+    static constexpr float kUnitRoundoff = 0;
+    static constexpr float kMinNormal = std::numeric_limits<float>::min();
+    static constexpr float kMax = std::numeric_limits<float>::max();
+};
+
+template <>
+struct HalfTraits<Fp16> {
+    static constexpr float kUnitRoundoff = 1.0F / 2048;  // 2^-11, 10 explicit bits
+    static constexpr float kMinNormal = 1.0F / 16384;    // 2^-14
+    static constexpr float kMax = 65504.0F;
+};
+
+template <>
+struct HalfTraits<Bf16> {
+    static constexpr float kUnitRoundoff = 1.0F / 256;  // 2^-8, 7 explicit bits
+    static constexpr float kMinNormal = std::numeric_limits<float>::min();
+    static constexpr float kMax = std::numeric_limits<float>::max();
+};
+
+inline float to_float(float val) { return val; }
+
+inline float to_float(Fp16 val) { return _cvtsh_ss(val.bits); }
+
+inline float to_float(Bf16 val) {
+    return half_impl::bits_float(static_cast<uint32_t>(val.bits) << 16);
+}
+
+// round to nearest (ties to even)
+template <typename T>
+inline T from_float(float val);
+
+template <>
+inline float from_float<float>(float val) {
+    return val;
+}
+
+template <>
+inline Fp16 from_float<Fp16>(float val) {
+    return {_cvtss_sh(val, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)};
+}
+
+template <>
+inline Bf16 from_float<Bf16>(float val) {
+    uint32_t bits = half_impl::float_bits(val);
+    bits += 0x7FFFU + ((bits >> 16) & 1U);
+    return {static_cast<uint16_t>(bits >> 16)};
+}
+
+// round towards +inf, so that stored error bounds are never smaller than the real ones
+template <typename T>
+inline T from_float_up(float val);
+
+template <>
+inline float from_float_up<float>(float val) {
+    return val;
+}
+
+template <>
+inline Fp16 from_float_up<Fp16>(float val) {
+    return {_cvtss_sh(val, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC)};
+}
+
+template <>
+inline Bf16 from_float_up<Bf16>(float val) {
+    uint32_t bits = half_impl::float_bits(val);
+    // truncation rounds negative values up, positive values need to be bumped
+    if ((bits & 0xFFFFU) != 0 && (bits >> 31) == 0) {
+        bits += 0x10000U;
+    }
+    return {static_cast<uint16_t>(bits >> 16)};
+}
+
+#if defined(__AVX512F__)
+// load 16 factors as floats
+inline __m512 load_factors(const float* src) { return _mm512_loadu_ps(src); }
+
+inline __m512 load_factors(const Fp16* src) {
+    return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+}
+
+inline __m512 load_factors(const Bf16* src) {
+    __m512i bits =
+        _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(bits, 16));
+}
+#endif
+}  // namespace rabitqlib
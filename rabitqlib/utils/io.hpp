@@ -1,12 +1,22 @@
 #pragma once
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <type_traits>
+#include <utility>
+
+#include "defines.hpp"
 
 namespace rabitqlib {
 // get num of bytes
@@ -18,63 +28,216 @@ inline size_t get_filesize(const char* filename) {
 
 inline bool file_exists(const char* filename) { return std::filesystem::exists(filename); }
 
-// load .*vecs file to a matrix (e.g., RowMajorFloatMat)
-template <typename T, class M>
-void load_vecs(const char* filename, M& row_mat) {
-    if (!file_exists(filename)) {
-        std::cerr << "File " << filename << " not exists\n";
-        exit(1);
+/**
+ * @brief Read-only memory mapping of a whole file. Pages are read by the kernel on demand
+ * (with read-ahead), so rows can be copied by multiple threads without any read() calls.
+ */
+class MappedFile {
+   public:
+    explicit MappedFile(const char* filename) {
+        if (!file_exists(filename)) {
+            std::cerr << "File " << filename << " not exists\n";
+            exit(1);
+        }
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Failed to open " << filename << '\n';
+            exit(1);
+        }
+        size_ = get_filesize(filename);
+        if (size_ > 0) {
+            void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                std::cerr << "Failed to mmap " << filename << '\n';
+                exit(1);
+            }
+            data_ = static_cast<const char*>(addr);
+        }
+        ::close(fd);  // the mapping stays valid
     }
 
-    assert((std::is_same_v<T*, std::decay_t<decltype(row_mat.data())>> == true));
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
 
-    uint32_t tmp;
-    size_t file_size = get_filesize(filename);
-    std::ifstream input(filename, std::ios::binary);
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    // hint the access pattern to the kernel, e.g., MADV_SEQUENTIAL for loading
+    void advise(int advice) const {
+        if (data_ != nullptr) {
+            ::madvise(const_cast<char*>(data_), size_, advice);
+        }
+    }
 
-    input.read(reinterpret_cast<char*>(&tmp), sizeof(uint32_t));
+    [[nodiscard]] const char* data() const { return data_; }
+
+    [[nodiscard]] size_t size() const { return size_; }
+
+   private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+namespace io_impl {
+// clamp [begin, end) to [0, rows)
+inline void clamp_range(size_t rows, size_t& begin, size_t& end) {
+    end = std::min(end, rows);
+    begin = std::min(begin, end);
+}
+}  // namespace io_impl
+
+/**
+ * @brief load .*vecs file to a matrix (e.g., RowMajorFloatMat). .bvecs files are loaded by
+ * load_vecs<uint8_t>(filename, RowMajorArray<uint8_t>&), and can be passed to IVF directly.
+ * The file is memory mapped, and rows are copied in parallel with their 4-byte headers
+ * stripped. Only rows [begin, end) are loaded, so that large files can be processed in
+ * shards.
+ */
+template <typename T, class M>
+void load_vecs(
+    const char* filename,
+    M& row_mat,
+    size_t begin = 0,
+    size_t end = std::numeric_limits<size_t>::max()
+) {
+    assert((std::is_same_v<T*, std::decay_t<decltype(row_mat.data())>> == true));
+
+    MappedFile file(filename);
+    if (file.size() < sizeof(uint32_t)) {
+        std::cerr << "File " << filename << " is empty\n";
+        exit(1);
+    }
 
+    uint32_t tmp;
+    std::memcpy(&tmp, file.data(), sizeof(uint32_t));
     size_t cols = tmp;
-    size_t rows = file_size / (cols * sizeof(T) + sizeof(uint32_t));
-    row_mat = M(rows, cols);
+    size_t row_bytes = (cols * sizeof(T)) + sizeof(uint32_t);
+    size_t rows = file.size() / row_bytes;
+    if (rows * row_bytes != file.size()) {
+        std::cerr << "File " << filename << " is not a valid .vecs file\n";
+        exit(1);
+    }
+    io_impl::clamp_range(rows, begin, end);
+    file.advise(MADV_SEQUENTIAL);
 
-    input.seekg(0, std::ifstream::beg);
+    row_mat = M(end - begin, cols);
 
-    for (size_t i = 0; i < rows; i++) {
-        input.read(reinterpret_cast<char*>(&tmp), sizeof(uint32_t));
-        input.read(reinterpret_cast<char*>(&row_mat(i, 0)), sizeof(T) * cols);
+    const char* src = file.data() + (begin * row_bytes) + sizeof(uint32_t);
+    auto* dst = reinterpret_cast<char*>(row_mat.data());
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < end - begin; i++) {
+        std::memcpy(dst + (i * cols * sizeof(T)), src + (i * row_bytes), cols * sizeof(T));
     }
 
     std::cout << "File " << filename << " loaded\n";
-    std::cout << "Rows " << rows << " Cols " << cols << '\n' << std::flush;
-    input.close();
+    std::cout << "Rows " << end - begin << " Cols " << cols << '\n' << std::flush;
 }
 
-// load .*bin file to a matrix (e.g., RowMajorFloatMat)
+/**
+ * @brief load .*bin file to a matrix (e.g., RowMajorFloatMat). For .u8bin, use uint8_t. For
+ * fp16/bf16 files, use uint16_t and pass data() as const Fp16* / const Bf16* (same layout).
+ * Rows [begin, end) are copied in parallel from the memory mapped file. See MappedBin for
+ * using the file without copying.
+ */
 template <typename T, class M>
-void load_bin(const char* filename, M& row_mat) {
-    if (!file_exists(filename)) {
-        std::cerr << "File " << filename << " not exists\n";
+void load_bin(
+    const char* filename,
+    M& row_mat,
+    size_t begin = 0,
+    size_t end = std::numeric_limits<size_t>::max()
+) {
+    assert((std::is_same_v<T*, std::decay_t<decltype(row_mat.data())>> == true));
+
+    MappedFile file(filename);
+    uint32_t header[2];  // rows, cols
+    if (file.size() < sizeof(header)) {
+        std::cerr << "File " << filename << " is empty\n";
         exit(1);
     }
+    std::memcpy(header, file.data(), sizeof(header));
+    size_t rows = header[0];
+    size_t cols = header[1];
+    if (file.size() < sizeof(header) + (rows * cols * sizeof(T))) {
+        std::cerr << "File " << filename << " is truncated\n";
+        exit(1);
+    }
+    io_impl::clamp_range(rows, begin, end);
+    file.advise(MADV_SEQUENTIAL);
+
+    row_mat = M(end - begin, cols);
+
+    // copy in row blocks of about 1MB, so that threads fault in different pages
+    size_t row_bytes = cols * sizeof(T);
+    size_t block_rows = std::max<size_t>(1, (1UL << 20) / std::max<size_t>(row_bytes, 1));
+    const char* src = file.data() + sizeof(header) + (begin * row_bytes);
+    auto* dst = reinterpret_cast<char*>(row_mat.data());
+    size_t num = end - begin;
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < num; i += block_rows) {
+        size_t cur_rows = std::min(block_rows, num - i);
+        std::memcpy(dst + (i * row_bytes), src + (i * row_bytes), cur_rows * row_bytes);
+    }
 
-    assert((std::is_same_v<T*, std::decay_t<decltype(row_mat.data())>> == true));
+    std::cout << "File " << filename << " loaded\n";
+    std::cout << "Rows " << num << " Cols " << cols << '\n' << std::flush;
+}
+
+/**
+ * @brief Zero-copy view of rows [begin, end) of a .*bin file. Rows are mapped instead of
+ * loaded, and pages are read when they are first accessed. The view is valid as long as
+ * the MappedBin is alive.
+ */
+template <typename T>
+class MappedBin {
+   public:
+    explicit MappedBin(
+        const char* filename, size_t begin = 0, size_t end = std::numeric_limits<size_t>::max()
+    )
+        : file_(filename) {
+        uint32_t header[2];  // rows, cols
+        if (file_.size() < sizeof(header)) {
+            std::cerr << "File " << filename << " is empty\n";
+            exit(1);
+        }
+        std::memcpy(header, file_.data(), sizeof(header));
+        size_t rows = header[0];
+        cols_ = header[1];
+        if (file_.size() < sizeof(header) + (rows * cols_ * sizeof(T))) {
+            std::cerr << "File " << filename << " is truncated\n";
+            exit(1);
+        }
+        io_impl::clamp_range(rows, begin, end);
+        rows_ = end - begin;
+        // the 8-byte header keeps rows aligned to sizeof(T) for T up to 8 bytes
+        data_ = reinterpret_cast<const T*>(file_.data() + sizeof(header)) + (begin * cols_);
+    }
 
-    uint32_t rows;
-    uint32_t cols;
-    std::ifstream input(filename, std::ios::binary);
+    [[nodiscard]] ConstRowMajorArrayMap<T> view() const {
+        return ConstRowMajorArrayMap<T>(
+            data_, static_cast<long>(rows_), static_cast<long>(cols_)
+        );
+    }
 
-    input.read(reinterpret_cast<char*>(&rows), sizeof(uint32_t));
-    input.read(reinterpret_cast<char*>(&cols), sizeof(uint32_t));
+    [[nodiscard]] const T* data() const { return data_; }
 
-    row_mat = M(rows, cols);
+    [[nodiscard]] size_t rows() const { return rows_; }
 
-    for (size_t i = 0; i < rows; i++) {
-        input.read(reinterpret_cast<char*>(&row_mat(i, 0)), sizeof(T) * cols);
-    }
+    [[nodiscard]] size_t cols() const { return cols_; }
 
-    std::cout << "File " << filename << " loaded\n";
-    std::cout << "Rows " << rows << " Cols " << cols << '\n' << std::flush;
-    input.close();
-}
-}  // namespace rabitqlib
\ No newline at end of file
+   private:
+    MappedFile file_;
+    const T* data_ = nullptr;
+    size_t rows_ = 0;
+    size_t cols_ = 0;
+};
+}  // namespace rabitqlib
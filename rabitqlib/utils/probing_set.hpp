@@ -0,0 +1,158 @@
+#pragma once
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "defines.hpp"
+#include "utils/memory.hpp"
+
+namespace rabitqlib {
+/**
+ * @brief open-addressing hash set to record visited vertices. Slots are grouped into
+ * buckets of one cache line and at most kMaxProbe buckets are probed linearly. Each slot
+ * stores (epoch << 32 | id), thus clear() only increases the epoch. The table is sized
+ * once by the expected num of ids, ids whose probed buckets are all full are recorded in
+ * a bitmap over all ids, so that no memory is allocated after construction.
+ */
+class ProbingBooleanSet {
+   private:
+    static constexpr size_t kBucketSize = 8;  // num of slots in a bucket (64 bytes)
+    static constexpr size_t kMaxProbe = 4;    // max num of buckets to probe
+    size_t num_buckets_ = 0;
+    size_t mask_ = 0;
+    uint64_t epoch_ = 1;  // slots with other epochs are empty
+    std::vector<uint64_t, memory::AlignedAllocator<uint64_t>> table_;
+    std::vector<uint64_t> overflow_;  // bitmap of ids not fitting in their probed buckets
+    bool has_overflow_ = false;       // if any bit of overflow_ is set in current epoch
+
+    [[nodiscard]] size_t hash(PID data_id) const {
+        return ((static_cast<uint64_t>(data_id) * 0x9E3779B97F4A7C15ULL) >> 32) & mask_;
+    }
+
+    [[nodiscard]] uint64_t key(PID data_id) const { return (epoch_ << 32) | data_id; }
+
+    [[nodiscard]] uint64_t* bucket(size_t bucket_id) {
+        return &table_[bucket_id * kBucketSize];
+    }
+
+    [[nodiscard]] const uint64_t* bucket(size_t bucket_id) const {
+        return &table_[bucket_id * kBucketSize];
+    }
+
+    // Slots are filled in order and never erased within an epoch, thus the slots of
+    // current epoch are always a prefix of the bucket.
+    // return true if key is in the bucket, otherwise pos is set to the first empty slot
+    // (kBucketSize if the bucket is full)
+    [[nodiscard]] bool find(const uint64_t* cur_bucket, uint64_t cur_key, size_t& pos)
+        const {
+#if defined(__AVX512F__)
+        __m512i slots = _mm512_load_si512(cur_bucket);
+        if (_mm512_cmpeq_epi64_mask(slots, _mm512_set1_epi64(static_cast<int64_t>(cur_key))
+            ) != 0) {
+            return true;
+        }
+        __mmask8 empty = _mm512_cmpneq_epi64_mask(
+            _mm512_srli_epi64(slots, 32), _mm512_set1_epi64(static_cast<int64_t>(epoch_))
+        );
+        pos = empty != 0 ? static_cast<size_t>(__builtin_ctz(empty)) : kBucketSize;
+        return false;
+#else
+        for (size_t i = 0; i < kBucketSize; ++i) {
+            if (cur_bucket[i] == cur_key) {
+                return true;
+            }
+            if ((cur_bucket[i] >> 32) != epoch_) {
+                pos = i;
+                return false;
+            }
+        }
+        pos = kBucketSize;
+        return false;
+#endif
+    }
+
+    [[nodiscard]] bool get_overflow(PID data_id) const {
+        return has_overflow_ && ((overflow_[data_id >> 6] >> (data_id & 63)) & 1) != 0;
+    }
+
+    void set_overflow(PID data_id) {
+        overflow_[data_id >> 6] |= 1ULL << (data_id & 63);
+        has_overflow_ = true;
+    }
+
+   public:
+    ProbingBooleanSet() = default;
+
+    /**
+     * @param capacity      expected num of ids recorded between two clear()
+     * @param max_elements  all ids are less than max_elements
+     */
+    ProbingBooleanSet(size_t capacity, size_t max_elements) {
+        // keep load factor under 1/2 for expected num of ids
+        size_t num_buckets = kMaxProbe;
+        while (num_buckets * kBucketSize < 2 * capacity) {
+            num_buckets <<= 1;
+        }
+        num_buckets_ = num_buckets;
+        mask_ = num_buckets_ - 1;
+        epoch_ = 1;
+        table_ = std::vector<uint64_t, memory::AlignedAllocator<uint64_t>>(
+            num_buckets_ * kBucketSize, 0
+        );
+        overflow_.assign((max_elements + 63) / 64, 0);
+        has_overflow_ = false;
+    }
+
+    void clear() {
+        if (has_overflow_) {
+            std::fill(overflow_.begin(), overflow_.end(), 0);
+            has_overflow_ = false;
+        }
+        ++epoch_;
+        // epoch overflows, reset all slots
+        if (epoch_ >> 32 != 0) {
+            std::fill(table_.begin(), table_.end(), 0);
+            epoch_ = 1;
+        }
+    }
+
+    // get if data_id is in the hashset
+    [[nodiscard]] bool get(PID data_id) const {
+        uint64_t cur_key = key(data_id);
+        size_t bucket_id = hash(data_id);
+        size_t pos;
+        for (size_t i = 0; i < kMaxProbe; ++i) {
+            if (find(bucket(bucket_id), cur_key, pos)) {
+                return true;
+            }
+            if (pos < kBucketSize) {
+                return false;
+            }
+            bucket_id = (bucket_id + 1) & mask_;
+        }
+        return get_overflow(data_id);
+    }
+
+    void set(PID data_id) {
+        uint64_t cur_key = key(data_id);
+        size_t bucket_id = hash(data_id);
+        size_t pos;
+        for (size_t i = 0; i < kMaxProbe; ++i) {
+            uint64_t* cur_bucket = bucket(bucket_id);
+            if (find(cur_bucket, cur_key, pos)) {
+                return;
+            }
+            if (pos < kBucketSize) {
+                cur_bucket[pos] = cur_key;
+                return;
+            }
+            bucket_id = (bucket_id + 1) & mask_;
+        }
+        set_overflow(data_id);
+    }
+};
+}  // namespace rabitqlib
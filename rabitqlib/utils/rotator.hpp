@@ -1,22 +1,31 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
-#include <functional>
 #include <iostream>
 #include <random>
+#include <type_traits>
+#include <vector>
 
 #include "defines.hpp"
 #include "utils/fht_avx.hpp"
+#include "utils/half.hpp"
 #include "utils/space.hpp"
 #include "utils/tools.hpp"
 
 namespace rabitqlib {
 
-enum class RotatorType : uint8_t { MatrixRotator, FhtKacRotator };
+/**
+ * @brief Types of rotators. FhtKac2Rotator and FhtKac1Rotator run 2 and 1 rounds of
+ * FhtKacRotator (4 rounds), which makes rotation cheaper at the cost of a less random
+ * rotation. Use sample/rotator_benchmark to compare their estimation errors on your data.
+ */
+enum class RotatorType : uint8_t { MatrixRotator, FhtKacRotator, FhtKac2Rotator, FhtKac1Rotator };
 
 // abstract rotator
 template <typename T>
@@ -30,9 +39,61 @@ class Rotator {
     explicit Rotator(size_t dim, size_t padded_dim) : dim_(dim), padded_dim_(padded_dim) {};
     virtual ~Rotator() = default;
     virtual void rotate(const T* src, T* dst) const = 0;
+    /**
+     * @brief rotate n vectors stored contiguously in src (row stride dim) into dst (row
+     * stride padded_dim). Derived rotators override this to amortize work across rows.
+     */
+    virtual void rotate_batch(const T* src, size_t n, T* dst) const {
+        for (size_t i = 0; i < n; ++i) {
+            rotate(src + (i * dim_), dst + (i * padded_dim_));
+        }
+    }
+    /**
+     * @brief rotate n vectors of uint8_t (e.g., .bvecs), fp16 or bf16 without converting the
+     * whole input to T first. By default, a few rows at a time are converted to T and
+     * rotated by rotate_batch(). FhtKacRotator converts them in its first pass.
+     */
+    virtual void rotate_batch(const uint8_t* src, size_t n, T* dst) const {
+        rotate_converted(src, n, dst);
+    }
+    virtual void rotate_batch(const Fp16* src, size_t n, T* dst) const {
+        rotate_converted(src, n, dst);
+    }
+    virtual void rotate_batch(const Bf16* src, size_t n, T* dst) const {
+        rotate_converted(src, n, dst);
+    }
+    template <typename TI>
+    void rotate(const TI* src, T* dst) const {
+        rotate_batch(src, 1, dst);
+    }
     virtual void load(std::ifstream&) = 0;
     virtual void save(std::ofstream&) const = 0;
     [[nodiscard]] size_t size() const { return this->padded_dim_; }
+
+   protected:
+    template <typename TI>
+    static T convert_input(TI val) {
+        if constexpr (std::is_arithmetic_v<TI>) {
+            return static_cast<T>(val);
+        } else {
+            return static_cast<T>(to_float(val));
+        }
+    }
+
+   private:
+    template <typename TI>
+    void rotate_converted(const TI* src, size_t n, T* dst) const {
+        constexpr size_t kRows = 32;
+        std::vector<T> rows(std::min(n, kRows) * dim_);
+        for (size_t i = 0; i < n; i += kRows) {
+            size_t num = std::min(kRows, n - i);
+            const TI* cur = src + (i * dim_);
+            for (size_t j = 0; j < num * dim_; ++j) {
+                rows[j] = convert_input(cur[j]);
+            }
+            rotate_batch(rows.data(), num, dst + (i * padded_dim_));
+        }
+    }
 };
 
 namespace rotator_impl {
@@ -42,13 +103,25 @@ inline size_t padding_requirement(size_t dim, RotatorType type) {
     if (type == RotatorType::MatrixRotator) {
         return dim;
     }
-    if (type == RotatorType::FhtKacRotator) {
+    if (type == RotatorType::FhtKacRotator || type == RotatorType::FhtKac2Rotator ||
+        type == RotatorType::FhtKac1Rotator) {
         return round_up_to_multiple(dim, 64);
     }
     std::cerr << "Invalid rotator type in padding_requirement()\n" << std::flush;
     exit(1);
 }
 
+// num of rounds of FhtKacRotator for different rotator types
+inline size_t fht_kac_rounds(RotatorType type) {
+    if (type == RotatorType::FhtKac2Rotator) {
+        return 2;
+    }
+    if (type == RotatorType::FhtKac1Rotator) {
+        return 1;
+    }
+    return 4;
+}
+
 template <typename T = float>
 class MatrixRotator : public Rotator<T> {
    private:
@@ -94,65 +167,145 @@ class MatrixRotator : public Rotator<T> {
         RowMajorMatrixMap<T> rv(rotated_vec, 1, this->padded_dim_);
         rv = v * this->rand_mat_;
     }
+
+    using Rotator<T>::rotate;
+    using Rotator<T>::rotate_batch;
+
+    // one blocked GEMM for all rows instead of n matrix-vector products
+    void rotate_batch(const T* src, size_t n, T* dst) const override {
+        ConstRowMajorMatrixMap<T> v(src, n, this->dim_);
+        RowMajorMatrixMap<T> rv(dst, n, this->padded_dim_);
+        rv.noalias() = v * this->rand_mat_;
+    }
 };
 
+// SIMD primitives for the passes of FhtKacRotator. AVX-512 handles 16 floats per step,
+// the AVX2 fallback handles 8 (the FFHT kernels themselves only require AVX).
+namespace fht_simd {
+#if defined(__AVX512F__)
+using Vec = __m512;
+constexpr size_t kLanes = 16;
+
+inline Vec load(const float* ptr) { return _mm512_loadu_ps(ptr); }
+inline void store(float* ptr, Vec vec) { _mm512_storeu_ps(ptr, vec); }
+inline Vec set1(float val) { return _mm512_set1_ps(val); }
+inline Vec add(Vec lhs, Vec rhs) { return _mm512_add_ps(lhs, rhs); }
+inline Vec sub(Vec lhs, Vec rhs) { return _mm512_sub_ps(lhs, rhs); }
+inline Vec mul(Vec lhs, Vec rhs) { return _mm512_mul_ps(lhs, rhs); }
+
+// load the first num (< kLanes) floats, zero the rest
+inline Vec load_partial(const float* ptr, size_t num) {
+    return _mm512_maskz_loadu_ps(_cvtu32_mask16((1U << num) - 1), ptr);
+}
+
+// load kLanes inputs as floats
+inline Vec load_as(const float* ptr) { return load(ptr); }
+inline Vec load_as(const uint8_t* ptr) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes));
+}
+inline Vec load_as(const Fp16* ptr) { return load_factors(ptr); }
+inline Vec load_as(const Bf16* ptr) { return load_factors(ptr); }
+
+// flip signs of vec with bits [i, i + kLanes) of the sign sequence flip
+inline Vec flip(Vec vec, const uint8_t* flip, size_t i) {
+    uint16_t bits;
+    std::memcpy(&bits, &flip[i / 8], sizeof(bits));
+    const __m512 sign_flip = _mm512_castsi512_ps(_mm512_set1_epi32(0x80000000));
+    return _mm512_mask_xor_ps(vec, _cvtu32_mask16(bits), vec, sign_flip);
+}
+#else
+using Vec = __m256;
+constexpr size_t kLanes = 8;
+
+inline Vec load(const float* ptr) { return _mm256_loadu_ps(ptr); }
+inline void store(float* ptr, Vec vec) { _mm256_storeu_ps(ptr, vec); }
+inline Vec set1(float val) { return _mm256_set1_ps(val); }
+inline Vec add(Vec lhs, Vec rhs) { return _mm256_add_ps(lhs, rhs); }
+inline Vec sub(Vec lhs, Vec rhs) { return _mm256_sub_ps(lhs, rhs); }
+inline Vec mul(Vec lhs, Vec rhs) { return _mm256_mul_ps(lhs, rhs); }
+
+inline Vec load_partial(const float* ptr, size_t num) {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(num)), lane);
+    return _mm256_maskload_ps(ptr, mask);
+}
+
+inline Vec load_as(const float* ptr) { return load(ptr); }
+inline Vec load_as(const uint8_t* ptr) {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(ptr));
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+}
+inline Vec load_as(const Fp16* ptr) {
+    return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)));
+}
+inline Vec load_as(const Bf16* ptr) {
+    __m256i bits =
+        _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 16));
+}
+
+inline Vec flip(Vec vec, const uint8_t* flip, size_t i) {
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i bits = _mm256_and_si256(_mm256_set1_epi32(flip[i / 8]), bit);
+    __m256i sign = _mm256_slli_epi32(_mm256_cmpeq_epi32(bits, bit), 31);
+    return _mm256_xor_ps(vec, _mm256_castsi256_ps(sign));
+}
+#endif
+}  // namespace fht_simd
+
 static inline void flip_sign(const uint8_t* flip, float* data, size_t dim) {
-    constexpr size_t kFloatsPerChunk = 64;  // Process 64 floats per iteration
-    // constexpr size_t bits_per_chunk = floats_per_chunk;  // 64 bits = 8 bytes
-
-    static_assert(
-        kFloatsPerChunk % 16 == 0,
-        "floats_per_chunk must be divisible by AVX512 register width"
-    );
-
-    for (size_t i = 0; i < dim; i += kFloatsPerChunk) {
-        // Load 64 bits (8 bytes) from the bit sequence
-        uint64_t mask_bits;
-        std::memcpy(&mask_bits, &flip[i / 8], sizeof(mask_bits));
-
-        // Split into four 16-bit mask segments
-        const __mmask16 mask0 = _cvtu32_mask16(static_cast<uint32_t>(mask_bits & 0xFFFF));
-        const __mmask16 mask1 =
-            _cvtu32_mask16(static_cast<uint32_t>((mask_bits >> 16) & 0xFFFF));
-        const __mmask16 mask2 =
-            _cvtu32_mask16(static_cast<uint32_t>((mask_bits >> 32) & 0xFFFF));
-        const __mmask16 mask3 =
-            _cvtu32_mask16(static_cast<uint32_t>((mask_bits >> 48) & 0xFFFF));
-
-        // Prepare sign-flip constant
-        const __m512 sign_flip = _mm512_castsi512_ps(_mm512_set1_epi32(0x80000000));
-
-        // Process 16 floats at a time with each mask segment
-        __m512 vec0 = _mm512_loadu_ps(&data[i]);
-        vec0 = _mm512_mask_xor_ps(vec0, mask0, vec0, sign_flip);
-        _mm512_storeu_ps(&data[i], vec0);
-
-        __m512 vec1 = _mm512_loadu_ps(&data[i + 16]);
-        vec1 = _mm512_mask_xor_ps(vec1, mask1, vec1, sign_flip);
-        _mm512_storeu_ps(&data[i + 16], vec1);
-
-        __m512 vec2 = _mm512_loadu_ps(&data[i + 32]);
-        vec2 = _mm512_mask_xor_ps(vec2, mask2, vec2, sign_flip);
-        _mm512_storeu_ps(&data[i + 32], vec2);
-
-        __m512 vec3 = _mm512_loadu_ps(&data[i + 48]);
-        vec3 = _mm512_mask_xor_ps(vec3, mask3, vec3, sign_flip);
-        _mm512_storeu_ps(&data[i + 48], vec3);
+    // dim % fht_simd::kLanes == 0
+    for (size_t i = 0; i < dim; i += fht_simd::kLanes) {
+        fht_simd::store(&data[i], fht_simd::flip(fht_simd::load(&data[i]), flip, i));
     }
 }
 
+using FhtFunc = void (*)(float*);
+
+// FFHT kernel for a transform of length 2^log_dim, nullptr if unsupported
+inline FhtFunc fht_kernel(size_t log_dim) {
+    static constexpr std::array<FhtFunc, 31> kKernels = {
+        nullptr,         nullptr,         nullptr,         nullptr,
+        helper_float_4,  helper_float_5,  helper_float_6,  helper_float_7,
+        helper_float_8,  helper_float_9,  helper_float_10, helper_float_11,
+        helper_float_12, helper_float_13, helper_float_14, helper_float_15,
+        helper_float_16, helper_float_17, helper_float_18, helper_float_19,
+        helper_float_20, helper_float_21, helper_float_22, helper_float_23,
+        helper_float_24, helper_float_25, helper_float_26, helper_float_27,
+        helper_float_28, helper_float_29, helper_float_30
+    };
+    return log_dim < kKernels.size() ? kKernels[log_dim] : nullptr;
+}
+
+/**
+ * @brief Each round flips signs randomly, applies FFHT on the first/last 2^k coordinates
+ * (alternately) and, if 2^k < padded_dim, a step of Kac's walk. 4 rounds by default; fewer
+ * rounds are cheaper but mix less, and a single round on non-power-of-2 dimensions only
+ * mixes the tail coordinates through one Kac's walk step.
+ */
 class FhtKacRotator : public Rotator<float> {
    private:
     std::vector<uint8_t> flip_;
-    std::function<void(float*)> fht_float_ = helper_float_6;
+    FhtFunc fht_float_ = helper_float_6;
     size_t trunc_dim_ = 0;
     float fac_ = 0;
+    size_t rounds_ = 4;
+    float kacs_fac_ = 0.25F;  // final rescale to undo the Kac's walk steps, 1 / sqrt(2^rounds)
 
     static constexpr size_t kByteLen = 8;
 
    public:
-    explicit FhtKacRotator(size_t dim, size_t padded_dim)
-        : Rotator<float>(dim, padded_dim), flip_(4 * padded_dim / kByteLen) {
+    explicit FhtKacRotator(size_t dim, size_t padded_dim, size_t rounds = 4)
+        : Rotator<float>(dim, padded_dim)
+        , flip_(rounds * padded_dim / kByteLen)
+        , rounds_(rounds)
+        , kacs_fac_(1.0F / std::sqrt(static_cast<float>(size_t(1) << rounds))) {
+        if (rounds == 0) {
+            std::cerr << "FhtKacRotator needs at least 1 round\n";
+            exit(1);
+        }
+
         std::random_device rd;   // Seed
         std::mt19937 gen(rd());  // Mersenne Twister RNG
 
@@ -166,38 +319,15 @@ class FhtKacRotator : public Rotator<float> {
 
         // TODO(lib): is it portable?
         size_t bottom_log_dim = floor_log2(dim);
-        trunc_dim_ = 1 << bottom_log_dim;
+        trunc_dim_ = static_cast<size_t>(1) << bottom_log_dim;
         fac_ = 1.0F / std::sqrt(static_cast<float>(trunc_dim_));
 
-        switch (bottom_log_dim) {
-            case 4:
-                this->fht_float_ = helper_float_4;
-                break;
-            case 5:   // 2^5 = 32
-                this->fht_float_ = helper_float_5;
-                break;
-            case 6:
-                this->fht_float_ = helper_float_6;
-                break;
-            case 7:
-                this->fht_float_ = helper_float_7;
-                break;
-            case 8:
-                this->fht_float_ = helper_float_8;
-                break;
-            case 9:
-                this->fht_float_ = helper_float_9;
-                break;
-            case 10:
-                this->fht_float_ = helper_float_10;
-                break;
-            case 11:
-                this->fht_float_ = helper_float_11;
-                break;
-            default:
-                // TODO(lib): should we do more?
-                std::cerr << "dimension of vector is too big\n";
-                exit(1);
+        // the FFHT kernels are recursive beyond 2^11 floats, so large dimensions keep
+        // O(D log D) time without switching to MatrixRotator
+        this->fht_float_ = fht_kernel(bottom_log_dim);
+        if (this->fht_float_ == nullptr) {
+            std::cerr << "FhtKacRotator does not support dimension " << dim << '\n';
+            exit(1);
         }
     }
     FhtKacRotator() = default;
@@ -224,76 +354,167 @@ class FhtKacRotator : public Rotator<float> {
         this->fht_float_ = other.fht_float_;
         this->trunc_dim_ = other.trunc_dim_;
         this->fac_ = other.fac_;
+        this->rounds_ = other.rounds_;
+        this->kacs_fac_ = other.kacs_fac_;
         return *this;
     }
 
     static void kacs_walk(float* data, size_t len) {
-        // ! len % 32 == 0;
-        for (size_t i = 0; i < len / 2; i += 16) {
-            __m512 x = _mm512_loadu_ps(&data[i]);
-            __m512 y = _mm512_loadu_ps(&data[i + (len / 2)]);
-
-            __m512 new_x = _mm512_add_ps(x, y);
-            __m512 new_y = _mm512_sub_ps(x, y);
+        // ! len % (2 * fht_simd::kLanes) == 0;
+        for (size_t i = 0; i < len / 2; i += fht_simd::kLanes) {
+            auto x = fht_simd::load(&data[i]);
+            auto y = fht_simd::load(&data[i + (len / 2)]);
 
-            _mm512_storeu_ps(&data[i], new_x);
-            _mm512_storeu_ps(&data[i + (len / 2)], new_y);
+            fht_simd::store(&data[i], fht_simd::add(x, y));
+            fht_simd::store(&data[i + (len / 2)], fht_simd::sub(x, y));
         }
     }
 
+    using Rotator<float>::rotate;
+
     void rotate(const float* data, float* rotated_vec) const override {
-        std::memcpy(rotated_vec, data, sizeof(float) * dim_);
-        std::fill(rotated_vec + dim_, rotated_vec + padded_dim_, 0);
+        rotate_group(data, 1, rotated_vec);
+    }
 
-        if (trunc_dim_ == padded_dim_) {
-            flip_sign(flip_.data(), rotated_vec, padded_dim_);
-            fht_float_(rotated_vec);
-            vec_rescale(rotated_vec, trunc_dim_, fac_);
+    void rotate_batch(const float* src, size_t n, float* dst) const override {
+        rotate_groups(src, n, dst);
+    }
 
-            flip_sign(flip_.data() + (padded_dim_ / kByteLen), rotated_vec, padded_dim_);
-            fht_float_(rotated_vec);
-            vec_rescale(rotated_vec, trunc_dim_, fac_);
+    // inputs are converted to float while being copied in the first pass
+    void rotate_batch(const uint8_t* src, size_t n, float* dst) const override {
+        rotate_groups(src, n, dst);
+    }
 
-            flip_sign(
-                flip_.data() + (2 * padded_dim_ / kByteLen), rotated_vec, padded_dim_
-            );
-            fht_float_(rotated_vec);
-            vec_rescale(rotated_vec, trunc_dim_, fac_);
+    void rotate_batch(const Fp16* src, size_t n, float* dst) const override {
+        rotate_groups(src, n, dst);
+    }
 
-            flip_sign(
-                flip_.data() + (3 * padded_dim_ / kByteLen), rotated_vec, padded_dim_
-            );
-            fht_float_(rotated_vec);
-            vec_rescale(rotated_vec, trunc_dim_, fac_);
+    void rotate_batch(const Bf16* src, size_t n, float* dst) const override {
+        rotate_groups(src, n, dst);
+    }
 
-            return;
+   private:
+    static constexpr size_t kGroupSize = 4;  // vectors advanced stage by stage together
+
+    [[nodiscard]] const uint8_t* round_flip(size_t round) const {
+        return flip_.data() + (round * padded_dim_ / kByteLen);
+    }
+
+    template <typename TI>
+    void rotate_groups(const TI* src, size_t n, float* dst) const {
+        for (size_t i = 0; i < n; i += kGroupSize) {
+            rotate_group(
+                src + (i * dim_), std::min(kGroupSize, n - i), dst + (i * padded_dim_)
+            );
         }
+    }
 
-        size_t start = padded_dim_ - trunc_dim_;
+    // conversion to float + copy + zero padding + first flip_sign in one pass
+    template <typename TI>
+    void load_flip(const TI* src, float* dst, const uint8_t* flip) const {
+        size_t i = 0;
+        for (; i + fht_simd::kLanes <= dim_; i += fht_simd::kLanes) {
+            fht_simd::store(&dst[i], fht_simd::flip(fht_simd::load_as(&src[i]), flip, i));
+        }
+        for (; i < padded_dim_; i += fht_simd::kLanes) {
+            fht_simd::Vec vec;
+            if constexpr (std::is_same_v<TI, float>) {
+                vec = fht_simd::load_partial(&src[i], i < dim_ ? dim_ - i : 0);
+            } else {
+                std::array<float, fht_simd::kLanes> tail{};
+                for (size_t j = i; j < dim_; ++j) {
+                    tail[j - i] = convert_input(src[j]);
+                }
+                vec = fht_simd::load(tail.data());
+            }
+            fht_simd::store(&dst[i], fht_simd::flip(vec, flip, i));
+        }
+    }
 
-        flip_sign(flip_.data(), rotated_vec, padded_dim_);
-        fht_float_(rotated_vec);
-        vec_rescale(rotated_vec, trunc_dim_, fac_);
-        kacs_walk(rotated_vec, padded_dim_);
+    // vec_rescale followed by the flip_sign of next round (power of 2 dims)
+    void rescale_flip(float* data, const uint8_t* flip) const {
+        const auto fac = fht_simd::set1(fac_);
+        for (size_t i = 0; i < padded_dim_; i += fht_simd::kLanes) {
+            auto vec = fht_simd::mul(fht_simd::load(&data[i]), fac);
+            if (flip != nullptr) {
+                vec = fht_simd::flip(vec, flip, i);
+            }
+            fht_simd::store(&data[i], vec);
+        }
+    }
 
-        flip_sign(flip_.data() + (padded_dim_ / kByteLen), rotated_vec, padded_dim_);
-        fht_float_(rotated_vec + start);
-        vec_rescale(rotated_vec + start, trunc_dim_, fac_);
-        kacs_walk(rotated_vec, padded_dim_);
+    /**
+     * @brief vec_rescale on data[lo, lo + trunc_dim_), kacs_walk, then flip_sign of next
+     * round or the final rescale by kacs_fac_ (flip == nullptr). lo and trunc_dim_ are
+     * multiples of the SIMD width, so every block is either in or out of the range.
+     */
+    void rescale_kacs_flip(float* data, size_t lo, const uint8_t* flip) const {
+        const auto fac = fht_simd::set1(fac_);
+        const auto kacs_fac = fht_simd::set1(kacs_fac_);
+        size_t half = padded_dim_ / 2;
+        size_t hi = lo + trunc_dim_;
+        for (size_t i = 0; i < half; i += fht_simd::kLanes) {
+            size_t j = i + half;
+            auto x = fht_simd::load(&data[i]);
+            auto y = fht_simd::load(&data[j]);
+            if (i >= lo && i < hi) {
+                x = fht_simd::mul(x, fac);
+            }
+            if (j >= lo && j < hi) {
+                y = fht_simd::mul(y, fac);
+            }
+            auto new_x = fht_simd::add(x, y);
+            auto new_y = fht_simd::sub(x, y);
+            if (flip != nullptr) {
+                new_x = fht_simd::flip(new_x, flip, i);
+                new_y = fht_simd::flip(new_y, flip, j);
+            } else {
+                new_x = fht_simd::mul(new_x, kacs_fac);
+                new_y = fht_simd::mul(new_y, kacs_fac);
+            }
+            fht_simd::store(&data[i], new_x);
+            fht_simd::store(&data[j], new_y);
+        }
+    }
 
-        flip_sign(flip_.data() + (2 * padded_dim_ / kByteLen), rotated_vec, padded_dim_);
-        fht_float_(rotated_vec);
-        vec_rescale(rotated_vec, trunc_dim_, fac_);
-        kacs_walk(rotated_vec, padded_dim_);
+    /**
+     * @brief rotate n <= kGroupSize vectors. Each stage is applied to all vectors before
+     * the next one starts, so the flip bits and the FHT kernel stay hot across vectors
+     * while the whole group stays in L1. Stages are fused into one pass between FHTs;
+     * every float sees the same operations in the same order as the unfused version.
+     */
+    template <typename TI>
+    void rotate_group(const TI* src, size_t n, float* dst) const {
+        for (size_t v = 0; v < n; ++v) {
+            load_flip(src + (v * dim_), dst + (v * padded_dim_), round_flip(0));
+        }
 
-        flip_sign(flip_.data() + (3 * padded_dim_ / kByteLen), rotated_vec, padded_dim_);
-        fht_float_(rotated_vec + start);
-        vec_rescale(rotated_vec + start, trunc_dim_, fac_);
-        kacs_walk(rotated_vec, padded_dim_);
+        if (trunc_dim_ == padded_dim_) {
+            for (size_t round = 0; round < rounds_; ++round) {
+                const uint8_t* next_flip =
+                    round + 1 < rounds_ ? round_flip(round + 1) : nullptr;
+                for (size_t v = 0; v < n; ++v) {
+                    float* vec = dst + (v * padded_dim_);
+                    fht_float_(vec);
+                    rescale_flip(vec, next_flip);
+                }
+            }
+            return;
+        }
 
-        // This can be removed if we don't care about the absolute value of
-        // similarities.
-        vec_rescale(rotated_vec, padded_dim_, 0.25F);
+        size_t start = padded_dim_ - trunc_dim_;
+        for (size_t round = 0; round < rounds_; ++round) {
+            // even rounds transform the head, odd rounds the tail
+            size_t lo = (round % 2 == 0) ? 0 : start;
+            // the final kacs_fac_ can be removed if we don't care about the absolute value
+            // of similarities
+            const uint8_t* next_flip = round + 1 < rounds_ ? round_flip(round + 1) : nullptr;
+            for (size_t v = 0; v < n; ++v) {
+                float* vec = dst + (v * padded_dim_);
+                fht_float_(vec + lo);
+                rescale_kacs_flip(vec, lo, next_flip);
+            }
+        }
     }
 };
 }  // namespace rotator_impl
@@ -318,13 +539,15 @@ Rotator<T>* choose_rotator(
         exit(1);
     }
 
-    if (type == RotatorType::FhtKacRotator) {
+    if (type == RotatorType::FhtKacRotator || type == RotatorType::FhtKac2Rotator ||
+        type == RotatorType::FhtKac1Rotator) {
         if (!std::is_same_v<T, float>) {
             std::cerr << "FhtKacRotator is only for float type currently\n";
             exit(1);
         }
-        std::cerr << "FhtKacRotator is selected\n";
-        return ::new rotator_impl::FhtKacRotator(dim, padded_dim);
+        size_t rounds = rotator_impl::fht_kac_rounds(type);
+        std::cerr << "FhtKacRotator (" << rounds << " rounds) is selected\n";
+        return ::new rotator_impl::FhtKacRotator(dim, padded_dim, rounds);
     }
 
     if (type == RotatorType::MatrixRotator) {
@@ -4,11 +4,13 @@
 #include <immintrin.h>
 #include <omp.h>
 
+#include <array>
 #include <cassert>
 #include <cstdint>
 #include <iostream>
 #include <limits>
 #include <type_traits>
+#include <vector>
 
 #include "defines.hpp"
 #include "utils/tools.hpp"
@@ -143,6 +145,36 @@ inline T l2norm_sqr(const T* __restrict__ vec0, size_t dim) {
     return v0.dot(v0);
 }
 
+// sum of positive and sum of negative elements of a vector in one pass
+template <typename T>
+inline void sum_pos_neg(const T* __restrict__ vec0, size_t dim, T& sum_pos, T& sum_neg) {
+#if defined(__AVX512F__)
+    if constexpr (std::is_same_v<T, float>) {
+        __m512 vpos = _mm512_setzero_ps();
+        __m512 vneg = _mm512_setzero_ps();
+        const __m512 zero = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= dim; i += 16) {
+            __m512 cur = _mm512_loadu_ps(vec0 + i);
+            vpos = _mm512_add_ps(vpos, _mm512_max_ps(cur, zero));
+            vneg = _mm512_add_ps(vneg, _mm512_min_ps(cur, zero));
+        }
+        if (i < dim) {
+            __mmask16 mask = _cvtu32_mask16((1U << (dim - i)) - 1);
+            __m512 cur = _mm512_maskz_loadu_ps(mask, vec0 + i);
+            vpos = _mm512_add_ps(vpos, _mm512_max_ps(cur, zero));
+            vneg = _mm512_add_ps(vneg, _mm512_min_ps(cur, zero));
+        }
+        sum_pos = _mm512_reduce_add_ps(vpos);
+        sum_neg = _mm512_reduce_add_ps(vneg);
+        return;
+    }
+#endif
+    ConstVectorMap<T> v0(vec0, dim);
+    sum_pos = v0.cwiseMax(static_cast<T>(0)).sum();
+    sum_neg = v0.cwiseMin(static_cast<T>(0)).sum();
+}
+
 template <typename T>
 inline T dot_product(const T* __restrict__ vec0, const T* __restrict__ vec1, size_t dim) {
     ConstVectorMap<T> v0(vec0, dim);
@@ -290,6 +322,34 @@ inline float ip16_fxu1_avx512(
     return result;
 }
 
+// inner products of the query and two 1-bit codes (e.g., two bit planes) in one pass
+inline void ip16_fxu1x2_avx512(
+    const float* __restrict__ query,
+    const uint8_t* __restrict__ compact_code0,
+    const uint8_t* __restrict__ compact_code1,
+    size_t dim,
+    float& result0,
+    float& result1
+) {
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+
+    for (size_t i = 0; i < dim; i += 16) {
+        __mmask16 mask0 = *reinterpret_cast<const __mmask16*>(compact_code0);
+        __mmask16 mask1 = *reinterpret_cast<const __mmask16*>(compact_code1);
+        __m512 q = _mm512_loadu_ps(query);
+
+        sum0 = _mm512_add_ps(_mm512_maskz_mov_ps(mask0, q), sum0);
+        sum1 = _mm512_add_ps(_mm512_maskz_mov_ps(mask1, q), sum1);
+
+        compact_code0 += 2;
+        compact_code1 += 2;
+        query += 16;
+    }
+    result0 = _mm512_reduce_add_ps(sum0);
+    result1 = _mm512_reduce_add_ps(sum1);
+}
+
 inline float ip16_fxu2_avx512(
     const float* __restrict__ query, const uint8_t* __restrict__ compact_code, size_t dim
 ) {
@@ -561,6 +621,256 @@ inline TF ip_fxi(const TF* __restrict__ vec0, const TI* __restrict__ vec1, size_
     ConstVectorMap<TI> v1(vec1, dim);
     return v0.dot(v1.template cast<TF>());
 }
+
+#if defined(__AVX512F__)
+// decode 64 ex codes (8 * ExBits bytes) in the compact layouts above into 4 vectors of 16
+// uint8 codes, the order of dimensions is the same as the ip functions above
+template <size_t ExBits>
+inline void decode64_u8_avx512(const uint8_t* __restrict__ compact_code, __m128i* vec) {
+    if constexpr (ExBits <= 1) {
+        for (size_t k = 0; k < 4; ++k) {
+            __mmask16 mask = *reinterpret_cast<const __mmask16*>(compact_code + (2 * k));
+            vec[k] = _mm512_cvtepi32_epi8(_mm512_maskz_set1_epi32(mask, 1));
+        }
+    } else if constexpr (ExBits == 2) {
+        const __m128i mask = _mm_set1_epi8(0b00000011);
+        for (size_t k = 0; k < 4; ++k) {
+            int32_t compact = *reinterpret_cast<const int32_t*>(compact_code + (4 * k));
+            __m128i code = _mm_set_epi32(compact >> 6, compact >> 4, compact >> 2, compact);
+            vec[k] = _mm_and_si128(code, mask);
+        }
+    } else if constexpr (ExBits == 3) {
+        const __m128i mask = _mm_set1_epi8(0b11);
+        const __m128i top_mask = _mm_set1_epi8(0b100);
+        __m128i compact2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(compact_code));
+        int64_t top_bit = *reinterpret_cast<const int64_t*>(compact_code + 16);
+
+        vec[0] = _mm_and_si128(compact2, mask);
+        vec[1] = _mm_and_si128(_mm_srli_epi16(compact2, 2), mask);
+        vec[2] = _mm_and_si128(_mm_srli_epi16(compact2, 4), mask);
+        vec[3] = _mm_and_si128(_mm_srli_epi16(compact2, 6), mask);
+
+        vec[0] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit << 1, top_bit << 2), top_mask), vec[0]
+        );
+        vec[1] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit >> 1, top_bit >> 0), top_mask), vec[1]
+        );
+        vec[2] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit >> 3, top_bit >> 2), top_mask), vec[2]
+        );
+        vec[3] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit >> 5, top_bit >> 4), top_mask), vec[3]
+        );
+    } else if constexpr (ExBits == 4) {
+        constexpr int64_t kMask = 0x0f0f0f0f0f0f0f0f;
+        for (size_t k = 0; k < 4; ++k) {
+            int64_t compact = *reinterpret_cast<const int64_t*>(compact_code + (8 * k));
+            vec[k] = _mm_set_epi64x((compact >> 4) & kMask, compact & kMask);
+        }
+    } else if constexpr (ExBits == 5) {
+        const __m128i mask = _mm_set1_epi8(0b1111);
+        const __m128i top_mask = _mm_set1_epi8(0b10000);
+        __m128i compact4_1 =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(compact_code));
+        __m128i compact4_2 =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(compact_code + 16));
+        int64_t top_bit = *reinterpret_cast<const int64_t*>(compact_code + 32);
+
+        vec[0] = _mm_and_si128(compact4_1, mask);
+        vec[1] = _mm_and_si128(_mm_srli_epi16(compact4_1, 4), mask);
+        vec[2] = _mm_and_si128(compact4_2, mask);
+        vec[3] = _mm_and_si128(_mm_srli_epi16(compact4_2, 4), mask);
+
+        vec[0] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit << 3, top_bit << 4), top_mask), vec[0]
+        );
+        vec[1] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit << 1, top_bit << 2), top_mask), vec[1]
+        );
+        vec[2] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit >> 1, top_bit >> 0), top_mask), vec[2]
+        );
+        vec[3] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit >> 3, top_bit >> 2), top_mask), vec[3]
+        );
+    } else if constexpr (ExBits == 6) {
+        constexpr int64_t kMask4 = 0x0f0f0f0f0f0f0f0f;
+        const __m128i mask2 = _mm_set1_epi8(0b00110000);
+        for (size_t k = 0; k < 4; ++k) {
+            const uint8_t* cur_code = compact_code + (12 * k);
+            int64_t compact4 = *reinterpret_cast<const int64_t*>(cur_code);
+            __m128i c4 = _mm_set_epi64x((compact4 >> 4) & kMask4, compact4 & kMask4);
+
+            int32_t compact2 = *reinterpret_cast<const int32_t*>(cur_code + 8);
+            __m128i c2 =
+                _mm_set_epi32(compact2 >> 2, compact2, compact2 << 2, compact2 << 4);
+            c2 = _mm_and_si128(c2, mask2);
+
+            vec[k] = _mm_or_si128(c2, c4);
+        }
+    } else if constexpr (ExBits == 7) {
+        const __m128i mask6 = _mm_set1_epi8(0b00111111);
+        const __m128i mask2 = _mm_set1_epi8(0b11000000);
+        const __m128i top_mask = _mm_set1_epi8(0b1000000);
+        __m128i cpt1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(compact_code));
+        __m128i cpt2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(compact_code + 16));
+        __m128i cpt3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(compact_code + 32));
+        int64_t top_bit = *reinterpret_cast<const int64_t*>(compact_code + 48);
+
+        vec[0] = _mm_and_si128(cpt1, mask6);
+        vec[1] = _mm_and_si128(cpt2, mask6);
+        vec[2] = _mm_and_si128(cpt3, mask6);
+        vec[3] = _mm_or_si128(
+            _mm_or_si128(
+                _mm_srli_epi16(_mm_and_si128(cpt1, mask2), 6),
+                _mm_srli_epi16(_mm_and_si128(cpt2, mask2), 4)
+            ),
+            _mm_srli_epi16(_mm_and_si128(cpt3, mask2), 2)
+        );
+
+        vec[0] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit << 5, top_bit << 6), top_mask), vec[0]
+        );
+        vec[1] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit << 3, top_bit << 4), top_mask), vec[1]
+        );
+        vec[2] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit << 1, top_bit << 2), top_mask), vec[2]
+        );
+        vec[3] = _mm_or_si128(
+            _mm_and_si128(_mm_set_epi64x(top_bit >> 1, top_bit << 0), top_mask), vec[3]
+        );
+    } else {
+        static_assert(ExBits == 8, "ex_bits should be in [0, 8]");
+        for (size_t k = 0; k < 4; ++k) {
+            vec[k] =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(compact_code + (16 * k)));
+        }
+    }
+}
+
+// decode 64 ex codes into 4 float vectors
+template <size_t ExBits>
+inline void decode64_fxu_avx512(const uint8_t* __restrict__ compact_code, __m512* cf) {
+    if constexpr (ExBits <= 1) {
+        const __m512 one = _mm512_set1_ps(1);
+        for (size_t k = 0; k < 4; ++k) {
+            __mmask16 mask = *reinterpret_cast<const __mmask16*>(compact_code + (2 * k));
+            cf[k] = _mm512_maskz_mov_ps(mask, one);
+        }
+    } else {
+        __m128i vec[4];
+        decode64_u8_avx512<ExBits>(compact_code, vec);
+        for (size_t k = 0; k < 4; ++k) {
+            cf[k] = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(vec[k]));
+        }
+    }
+}
+
+// ip64_fxu_batch: inner products between one query and Num ex codes at the same time. Each
+// 64 dims of the query are loaded once and reused by all codes.
+template <size_t ExBits, size_t Num>
+inline void ip64_fxu_batch_avx512(
+    const float* __restrict__ query,
+    const uint8_t* const* __restrict__ compact_codes,
+    size_t dim,
+    float* __restrict__ results
+) {
+    constexpr size_t kBits = ExBits == 0 ? 1 : ExBits;
+    constexpr size_t kCodeBytes = 8 * kBits;  // bytes for 64 dims
+
+    __m512 sum[Num];
+    for (size_t j = 0; j < Num; ++j) {
+        sum[j] = _mm512_setzero_ps();
+    }
+
+    __m512 cf[4];
+    for (size_t i = 0, offset = 0; i < dim; i += 64, offset += kCodeBytes) {
+        __m512 q0 = _mm512_loadu_ps(&query[i]);
+        __m512 q1 = _mm512_loadu_ps(&query[i + 16]);
+        __m512 q2 = _mm512_loadu_ps(&query[i + 32]);
+        __m512 q3 = _mm512_loadu_ps(&query[i + 48]);
+        for (size_t j = 0; j < Num; ++j) {
+            decode64_fxu_avx512<kBits>(compact_codes[j] + offset, cf);
+            sum[j] = _mm512_fmadd_ps(q0, cf[0], sum[j]);
+            sum[j] = _mm512_fmadd_ps(q1, cf[1], sum[j]);
+            sum[j] = _mm512_fmadd_ps(q2, cf[2], sum[j]);
+            sum[j] = _mm512_fmadd_ps(q3, cf[3], sum[j]);
+        }
+    }
+
+    for (size_t j = 0; j < Num; ++j) {
+        results[j] = _mm512_reduce_add_ps(sum[j]);
+    }
+}
+
+#if defined(__AVX512BW__)
+// integer version of ip64_fxu_batch_avx512 for int8 or int16 quantized query (TQ). With
+// AVX-512 VNNI, uint8 x int8 products are accumulated by vpdpbusd and int16 x int16
+// products by vpdpwssd, otherwise by vpmaddubsw/vpmaddwd. vpmaddubsw saturates int16, thus
+// the int8 query is only used for codes with at most 3 bits (see SplitBatchQuery).
+template <size_t ExBits, size_t Num, typename TQ>
+inline void ip64_fxu_batch_int_avx512(
+    const TQ* __restrict__ query,
+    const uint8_t* const* __restrict__ compact_codes,
+    size_t dim,
+    int32_t* __restrict__ results
+) {
+    static_assert(
+        std::is_same_v<TQ, int8_t> || std::is_same_v<TQ, int16_t>, "TQ must be int8/int16"
+    );
+    constexpr size_t kBits = ExBits == 0 ? 1 : ExBits;
+    constexpr size_t kCodeBytes = 8 * kBits;  // bytes for 64 dims
+
+    __m512i sum[Num];
+    for (size_t j = 0; j < Num; ++j) {
+        sum[j] = _mm512_setzero_si512();
+    }
+
+    __m128i vec[4];
+    for (size_t i = 0, offset = 0; i < dim; i += 64, offset += kCodeBytes) {
+        if constexpr (std::is_same_v<TQ, int8_t>) {
+            __m512i q = _mm512_loadu_si512(&query[i]);
+            for (size_t j = 0; j < Num; ++j) {
+                decode64_u8_avx512<kBits>(compact_codes[j] + offset, vec);
+                __m512i code = _mm512_castsi128_si512(vec[0]);
+                code = _mm512_inserti32x4(code, vec[1], 1);
+                code = _mm512_inserti32x4(code, vec[2], 2);
+                code = _mm512_inserti32x4(code, vec[3], 3);
+#if defined(__AVX512VNNI__)
+                sum[j] = _mm512_dpbusd_epi32(sum[j], code, q);
+#else
+                __m512i prod = _mm512_maddubs_epi16(code, q);
+                sum[j] = _mm512_add_epi32(
+                    sum[j], _mm512_madd_epi16(prod, _mm512_set1_epi16(1))
+                );
+#endif
+            }
+        } else {
+            __m512i q0 = _mm512_loadu_si512(&query[i]);
+            __m512i q1 = _mm512_loadu_si512(&query[i + 32]);
+            for (size_t j = 0; j < Num; ++j) {
+                decode64_u8_avx512<kBits>(compact_codes[j] + offset, vec);
+                __m512i code0 = _mm512_cvtepu8_epi16(_mm256_set_m128i(vec[1], vec[0]));
+                __m512i code1 = _mm512_cvtepu8_epi16(_mm256_set_m128i(vec[3], vec[2]));
+#if defined(__AVX512VNNI__)
+                sum[j] = _mm512_dpwssd_epi32(sum[j], code0, q0);
+                sum[j] = _mm512_dpwssd_epi32(sum[j], code1, q1);
+#else
+                sum[j] = _mm512_add_epi32(sum[j], _mm512_madd_epi16(code0, q0));
+                sum[j] = _mm512_add_epi32(sum[j], _mm512_madd_epi16(code1, q1));
+#endif
+            }
+        }
+    }
+
+    for (size_t j = 0; j < Num; ++j) {
+        results[j] = _mm512_reduce_add_epi32(sum[j]);
+    }
+}
+#endif
+#endif
 }  // namespace excode_ipimpl
 
 using ex_ipfunc = float (*)(const float*, const uint8_t*, size_t);
@@ -623,6 +933,185 @@ inline ex_ipfunc select_excode_ipfunc(size_t ex_bits) {
         exit(1);
     }
 
+// compile-time counterpart of select_excode_ipfunc(), which allows the ip function to be
+// inlined into kernels specialized for a given ex_bits
+template <size_t ExBits>
+inline float excode_ip(const float* query, const uint8_t* code, size_t dim) {
+#if defined(USE_EXPLICIT_SIMD)
+    if constexpr (ExBits <= 1) {
+        return excode_ipimpl::ip16_fxu1_avx512(query, code, dim);
+    } else if constexpr (ExBits == 2) {
+        return excode_ipimpl::ip16_fxu2_avx512(query, code, dim);
+    } else if constexpr (ExBits == 3) {
+        return excode_ipimpl::ip64_fxu3_avx512(query, code, dim);
+    } else if constexpr (ExBits == 4) {
+        return excode_ipimpl::ip16_fxu4_avx512(query, code, dim);
+    } else if constexpr (ExBits == 5) {
+        return excode_ipimpl::ip64_fxu5_avx512(query, code, dim);
+    } else if constexpr (ExBits == 6) {
+        return excode_ipimpl::ip16_fxu6_avx512(query, code, dim);
+    } else if constexpr (ExBits == 7) {
+        return excode_ipimpl::ip64_fxu7_avx512(query, code, dim);
+    } else {
+        static_assert(ExBits == 8, "ex_bits should be in [0, 8]");
+        return excode_ipimpl::ip_fxi(query, code, dim);
+    }
+#else
+    return select_excode_ipfunc(ExBits)(query, code, dim);
+#endif
+}
+
+// max num of ex codes in excode_ip_batch()
+constexpr size_t kExIpBatch = 4;
+
+/**
+ * @brief Inner products between the query and num (<= kExIpBatch) ex codes. The codes are
+ * decoded in an interleaved way so that each load of the query is shared by all codes. dim
+ * should be a multiple of 64.
+ */
+template <size_t ExBits>
+inline void excode_ip_batch(
+    const float* query,
+    const uint8_t* const* codes,
+    size_t num,
+    size_t dim,
+    float* results
+) {
+#if defined(__AVX512F__)
+    switch (num) {
+        case 4:
+            excode_ipimpl::ip64_fxu_batch_avx512<ExBits, 4>(query, codes, dim, results);
+            return;
+        case 3:
+            excode_ipimpl::ip64_fxu_batch_avx512<ExBits, 3>(query, codes, dim, results);
+            return;
+        case 2:
+            excode_ipimpl::ip64_fxu_batch_avx512<ExBits, 2>(query, codes, dim, results);
+            return;
+        case 1:
+            excode_ipimpl::ip64_fxu_batch_avx512<ExBits, 1>(query, codes, dim, results);
+            return;
+        default:
+            return;
+    }
+#else
+    ex_ipfunc ip_func = select_excode_ipfunc(ExBits);
+    for (size_t j = 0; j < num; ++j) {
+        results[j] = ip_func(query, codes[j], dim);
+    }
+#endif
+}
+
+using ex_ipbatch_func = void (*)(const float*, const uint8_t* const*, size_t, size_t, float*);
+
+inline ex_ipbatch_func select_excode_ipbatch(size_t ex_bits) {
+    switch (ex_bits) {
+        case 0:
+        case 1:
+            return excode_ip_batch<1>;
+        case 2:
+            return excode_ip_batch<2>;
+        case 3:
+            return excode_ip_batch<3>;
+        case 4:
+            return excode_ip_batch<4>;
+        case 5:
+            return excode_ip_batch<5>;
+        case 6:
+            return excode_ip_batch<6>;
+        case 7:
+            return excode_ip_batch<7>;
+        case 8:
+            return excode_ip_batch<8>;
+        default:
+            std::cerr << "Bad batch IP function for IVF\n";
+            exit(1);
+    }
+}
+
+/**
+ * @brief Same as excode_ip_batch() but the query is quantized to integers (int8 or int16,
+ * see SplitBatchQuery::quantize_int()), i.e., query ~= delta * query_int. The ip is
+ * computed by integer dot products with AVX-512 BW/VNNI, otherwise the query is
+ * dequantized.
+ */
+template <size_t ExBits, typename TQ>
+inline void excode_ip_batch_int(
+    const TQ* query,
+    float delta,
+    const uint8_t* const* codes,
+    size_t num,
+    size_t dim,
+    float* results
+) {
+#if defined(__AVX512BW__)
+    std::array<int32_t, kExIpBatch> ip_int;
+    switch (num) {
+        case 4:
+            excode_ipimpl::ip64_fxu_batch_int_avx512<ExBits, 4>(
+                query, codes, dim, ip_int.data()
+            );
+            break;
+        case 3:
+            excode_ipimpl::ip64_fxu_batch_int_avx512<ExBits, 3>(
+                query, codes, dim, ip_int.data()
+            );
+            break;
+        case 2:
+            excode_ipimpl::ip64_fxu_batch_int_avx512<ExBits, 2>(
+                query, codes, dim, ip_int.data()
+            );
+            break;
+        case 1:
+            excode_ipimpl::ip64_fxu_batch_int_avx512<ExBits, 1>(
+                query, codes, dim, ip_int.data()
+            );
+            break;
+        default:
+            return;
+    }
+    for (size_t j = 0; j < num; ++j) {
+        results[j] = delta * static_cast<float>(ip_int[j]);
+    }
+#else
+    std::vector<float> dequantized(dim);
+    for (size_t i = 0; i < dim; ++i) {
+        dequantized[i] = delta * static_cast<float>(query[i]);
+    }
+    excode_ip_batch<ExBits>(dequantized.data(), codes, num, dim, results);
+#endif
+}
+
+template <typename TQ>
+using ex_ipbatch_int_func =
+    void (*)(const TQ*, float, const uint8_t* const*, size_t, size_t, float*);
+
+template <typename TQ>
+inline ex_ipbatch_int_func<TQ> select_excode_ipbatch_int(size_t ex_bits) {
+    switch (ex_bits) {
+        case 0:
+        case 1:
+            return excode_ip_batch_int<1, TQ>;
+        case 2:
+            return excode_ip_batch_int<2, TQ>;
+        case 3:
+            return excode_ip_batch_int<3, TQ>;
+        case 4:
+            return excode_ip_batch_int<4, TQ>;
+        case 5:
+            return excode_ip_batch_int<5, TQ>;
+        case 6:
+            return excode_ip_batch_int<6, TQ>;
+        case 7:
+            return excode_ip_batch_int<7, TQ>;
+        case 8:
+            return excode_ip_batch_int<8, TQ>;
+        default:
+            std::cerr << "Bad batch IP function for IVF\n";
+            exit(1);
+    }
+}
+
 static inline uint32_t reverse_bits(uint32_t n) {
     n = ((n >> 1) & 0x55555555) | ((n << 1) & 0xaaaaaaaa);
     n = ((n >> 2) & 0x33333333) | ((n << 2) & 0xcccccccc);
@@ -1,49 +1,146 @@
 #pragma once
+#include <cstdint>
 #include <deque>
 #include <mutex>
 
 #include "utils/hashset.hpp"
+#include "utils/probing_set.hpp"
 
 namespace rabitqlib {
+// kind of visited set, kHashBased: HashBasedBooleanSet, kProbing: ProbingBooleanSet with
+// O(1) clear and no memory allocation during search
+enum class VisitedSetType : std::uint8_t { kHashBased, kProbing };
+
+/**
+ * @brief visited set used by graph indices, the kind of set is chosen on construction
+ */
+class VisitedSet {
+   private:
+    VisitedSetType type_ = VisitedSetType::kHashBased;
+    HashBasedBooleanSet hash_set_;
+    ProbingBooleanSet probing_set_;
+
+   public:
+    VisitedSet() = default;
+
+    /**
+     * @param type          kind of visited set
+     * @param size          size of HashBasedBooleanSet, or expected num of ids recorded
+     *                      between two clear() for ProbingBooleanSet
+     * @param max_elements  all ids are less than max_elements
+     */
+    VisitedSet(VisitedSetType type, size_t size, size_t max_elements) : type_(type) {
+        if (type_ == VisitedSetType::kProbing) {
+            probing_set_ = ProbingBooleanSet(size, max_elements);
+        } else {
+            hash_set_ = HashBasedBooleanSet(size);
+        }
+    }
+
+    void clear() {
+        if (type_ == VisitedSetType::kProbing) {
+            probing_set_.clear();
+        } else {
+            hash_set_.clear();
+        }
+    }
+
+    // get if data_id is in the set
+    [[nodiscard]] bool get(PID data_id) const {
+        return type_ == VisitedSetType::kProbing ? probing_set_.get(data_id)
+                                                 : hash_set_.get(data_id);
+    }
+
+    void set(PID data_id) {
+        if (type_ == VisitedSetType::kProbing) {
+            probing_set_.set(data_id);
+        } else {
+            hash_set_.set(data_id);
+        }
+    }
+};
+
 class VisitedListPool {
-    std::deque<HashBasedBooleanSet*> pool_;
+    std::deque<VisitedSet*> pool_;
     std::mutex poolguard_;
     size_t numelements_;
+    size_t max_elements_;
+    size_t capacity_;
+    VisitedSetType type_;
+
+    [[nodiscard]] VisitedSet* new_vislist() const {
+        return new VisitedSet(
+            type_, type_ == VisitedSetType::kProbing ? capacity_ : numelements_, max_elements_
+        );
+    }
+
+    void clear_pool() {
+        while (pool_.size() > 0) {
+            VisitedSet* rez = pool_.front();
+            pool_.pop_front();
+            ::delete rez;
+        }
+    }
 
    public:
-    VisitedListPool(size_t initpoolsize, size_t max_elements) {
-        numelements_ = max_elements / 10;
+    /**
+     * @param initpoolsize  num of visited sets created initially
+     * @param max_elements  all ids are less than max_elements
+     * @param type          kind of visited sets
+     * @param capacity      expected num of ids visited by a search, only used by kProbing
+     */
+    VisitedListPool(
+        size_t initpoolsize,
+        size_t max_elements,
+        VisitedSetType type = VisitedSetType::kHashBased,
+        size_t capacity = 0
+    )
+        : numelements_(max_elements / 10)
+        , max_elements_(max_elements)
+        , capacity_(capacity)
+        , type_(type) {
         for (size_t i = 0; i < initpoolsize; i++) {
-            pool_.push_front(new HashBasedBooleanSet(numelements_));
+            pool_.push_front(new_vislist());
         }
     }
 
-    HashBasedBooleanSet* get_free_vislist() {
-        HashBasedBooleanSet* rez;
+    /**
+     * @brief raise the expected num of ids visited by a search. Pooled kProbing sets are
+     * rebuilt here so that they never grow during search. Not thread safe with searches.
+     */
+    void set_capacity(size_t capacity) {
+        if (type_ != VisitedSetType::kProbing || capacity <= capacity_) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(poolguard_);
+        capacity_ = capacity;
+        size_t num_sets = pool_.size();
+        clear_pool();
+        for (size_t i = 0; i < num_sets; i++) {
+            pool_.push_front(new_vislist());
+        }
+    }
+
+    VisitedSet* get_free_vislist() {
+        VisitedSet* rez;
         {
             std::unique_lock<std::mutex> lock(poolguard_);
             if (pool_.size() > 0) {
                 rez = pool_.front();
                 pool_.pop_front();
             } else {
-                rez = new HashBasedBooleanSet(numelements_);
+                rez = new_vislist();
             }
         }
         rez->clear();
         return rez;
     }
 
-    void release_vis_list(HashBasedBooleanSet* vl) {
+    void release_vis_list(VisitedSet* vl) {
         std::unique_lock<std::mutex> lock(poolguard_);
         pool_.push_front(vl);
     }
 
-    ~VisitedListPool() {
-        while (pool_.size() > 0) {
-            HashBasedBooleanSet* rez = pool_.front();
-            pool_.pop_front();
-            ::delete rez;
-        }
-    }
+    ~VisitedListPool() { clear_pool(); }
 };
-}  // namespace rabitqlib
\ No newline at end of file
+}  // namespace rabitqlib
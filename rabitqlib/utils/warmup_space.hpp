@@ -134,6 +134,69 @@ inline float warmup_ip_x0_q(
 #endif
 }
 
+/**
+ * @brief Same as warmup_ip_x0_q() but the query is stored plane by plane, i.e., the j-th
+ * bit of the query for 64-dim block i is query[j * (padded_dim / 64) + i]. Thus, each plane
+ * is loaded contiguously and the loop only consists of AND, VPOPCNTQ and ADD. The weights
+ * of planes are applied after the loop.
+ */
+template <uint32_t b_query>
+inline float warmup_ip_x0_q_planes(
+    const uint64_t* data,   // pointer to data blocks (each 64 bits)
+    const uint64_t* query,  // pointer to query planes, each has padded_dim / 64 words
+    float delta,
+    float vl,
+    size_t padded_dim
+) {
+    const size_t num_blk = padded_dim / 64;
+#if defined(USE_EXPLICIT_SIMD)
+    constexpr size_t kVecWidth = 8;
+
+    __m512i ppc_vec = _mm512_setzero_si512();
+    __m512i ip_vec[b_query];
+    for (uint32_t j = 0; j < b_query; ++j) {
+        ip_vec[j] = _mm512_setzero_si512();
+    }
+
+    for (size_t i = 0; i < num_blk; i += kVecWidth) {
+        // the last chunk may have less than 8 blocks
+        __mmask8 mask = num_blk - i >= kVecWidth
+                            ? static_cast<__mmask8>(0xFF)
+                            : static_cast<__mmask8>((1U << (num_blk - i)) - 1);
+        __m512i x_vec = _mm512_maskz_loadu_epi64(mask, data + i);
+        ppc_vec = _mm512_add_epi64(ppc_vec, _mm512_popcnt_epi64(x_vec));
+
+        for (uint32_t j = 0; j < b_query; ++j) {
+            __m512i q_vec = _mm512_maskz_loadu_epi64(mask, query + (j * num_blk) + i);
+            __m512i and_vec = _mm512_and_si512(x_vec, q_vec);
+            ip_vec[j] = _mm512_add_epi64(ip_vec[j], _mm512_popcnt_epi64(and_vec));
+        }
+    }
+
+    __m512i ip_sum = ip_vec[0];
+    for (uint32_t j = 1; j < b_query; ++j) {
+        ip_sum = _mm512_add_epi64(ip_sum, _mm512_slli_epi64(ip_vec[j], j));
+    }
+    auto ip_scalar = static_cast<size_t>(_mm512_reduce_add_epi64(ip_sum));
+    auto ppc_scalar = static_cast<size_t>(_mm512_reduce_add_epi64(ppc_vec));
+#else
+    size_t ip_scalar = 0;
+    size_t ppc_scalar = 0;
+    for (size_t i = 0; i < num_blk; ++i) {
+        ppc_scalar += __builtin_popcountll(data[i]);
+    }
+    for (uint32_t j = 0; j < b_query; ++j) {
+        const uint64_t* plane = query + (j * num_blk);
+        size_t plane_ip = 0;
+        for (size_t i = 0; i < num_blk; ++i) {
+            plane_ip += __builtin_popcountll(data[i] & plane[i]);
+        }
+        ip_scalar += plane_ip << j;
+    }
+#endif
+    return (delta * static_cast<float>(ip_scalar)) + (vl * static_cast<float>(ppc_scalar));
+}
+
 template <uint32_t b_query, uint32_t padded_dim>
 inline float warmup_ip_x0_q(
     const uint64_t* data,
@@ -0,0 +1,224 @@
+#ifndef USE_EXPLICIT_SIMD
+#define USE_EXPLICIT_SIMD = true
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "defines.hpp"
+#include "quantization/rabitq.hpp"
+#include "utils/io.hpp"
+#include "utils/rotator.hpp"
+#include "utils/space.hpp"
+#include "utils/stopw.hpp"
+
+using data_type = rabitqlib::RowMajorArray<float>;
+
+/**
+ * Compare rotators on a sample of the data. For each rotator, the sample is rotated and
+ * quantized (with the mean of the sample as the centroid), then the distances between
+ * queries (other vectors from the data) and the sample are estimated and compared with
+ * the exact distances. Rotation time per query is reported as well, so that the cheapest
+ * rotator with an acceptable error can be picked for an index.
+ */
+
+struct Report {
+    const char* name;
+    double rotate_us = 0;   // rotation time per vector
+    double mean_rel = 0;    // mean relative error of estimated distances
+    double p99_rel = 0;     // 99th percentile of relative error
+    double recall = 0;      // recall of top-k by estimated distances
+};
+
+static constexpr size_t kTopk = 10;
+
+static Report evaluate(
+    const char* name,
+    rabitqlib::RotatorType type,
+    const float* sample,
+    size_t num_sample,
+    const float* queries,
+    size_t num_query,
+    size_t dim,
+    size_t total_bits,
+    const std::vector<std::vector<uint32_t>>& gt
+) {
+    Report report{name};
+    rabitqlib::Rotator<float>* rotator = rabitqlib::choose_rotator<float>(
+        dim, type, rabitqlib::rotator_impl::padding_requirement(dim, type)
+    );
+    size_t padded_dim = rotator->size();
+
+    std::vector<float> rotated(num_sample * padded_dim);
+    rotator->rotate_batch(sample, num_sample, rotated.data());
+
+    // rotation of queries, one by one as in search
+    std::vector<float> rotated_query(num_query * padded_dim);
+    rabitqlib::StopW stopw;
+    for (size_t i = 0; i < num_query; ++i) {
+        rotator->rotate(queries + (i * dim), &rotated_query[i * padded_dim]);
+    }
+    report.rotate_us = stopw.get_elapsed_nano() / 1000.0 / static_cast<double>(num_query);
+
+    std::vector<float> centroid(padded_dim, 0);
+    for (size_t i = 0; i < num_sample; ++i) {
+        for (size_t j = 0; j < padded_dim; ++j) {
+            centroid[j] += rotated[(i * padded_dim) + j] / static_cast<float>(num_sample);
+        }
+    }
+
+    // total_bits codes and factors of the sample
+    std::vector<uint8_t> codes(num_sample * padded_dim);
+    std::vector<float> f_add(num_sample);
+    std::vector<float> f_rescale(num_sample);
+    std::vector<float> f_error(num_sample);
+    std::vector<int> binary_code(padded_dim);
+#pragma omp parallel for firstprivate(binary_code)
+    for (size_t i = 0; i < num_sample; ++i) {
+        const float* vec = &rotated[i * padded_dim];
+        uint8_t* code = &codes[i * padded_dim];
+        if (total_bits == 1) {
+            rabitqlib::quant::rabitq_impl::one_bit::one_bit_code_with_factor(
+                vec, centroid.data(), padded_dim, binary_code.data(), f_add[i], f_rescale[i],
+                f_error[i]
+            );
+            std::copy(binary_code.begin(), binary_code.end(), code);
+        } else {
+            rabitqlib::quant::quantize_full_single(
+                vec, centroid.data(), padded_dim, total_bits, code, f_add[i], f_rescale[i],
+                f_error[i]
+            );
+        }
+    }
+
+    // est = f_add + |q - c|^2 + f_rescale * (<x_u, q> + c_B * sum(q)), see estimator.md
+    float c_b = -static_cast<float>((1 << total_bits) - 1) / 2;
+    std::vector<double> rel_errors(num_query * num_sample);
+    size_t hit = 0;
+#pragma omp parallel for reduction(+ : hit)
+    for (size_t q = 0; q < num_query; ++q) {
+        const float* query = &rotated_query[q * padded_dim];
+        float g_add = rabitqlib::euclidean_sqr(query, centroid.data(), padded_dim);
+        float sum_q = std::accumulate(query, query + padded_dim, 0.0F);
+        std::vector<std::pair<float, uint32_t>> est(num_sample);
+        for (size_t i = 0; i < num_sample; ++i) {
+            const uint8_t* code = &codes[i * padded_dim];
+            float ip = 0;
+            for (size_t j = 0; j < padded_dim; ++j) {
+                ip += static_cast<float>(code[j]) * query[j];
+            }
+            float est_dist = f_add[i] + g_add + (f_rescale[i] * (ip + (c_b * sum_q)));
+            float dist =
+                rabitqlib::euclidean_sqr(queries + (q * dim), sample + (i * dim), dim);
+            rel_errors[(q * num_sample) + i] =
+                std::abs(est_dist - dist) / std::max(dist, 1e-12F);
+            est[i] = {est_dist, static_cast<uint32_t>(i)};
+        }
+        std::partial_sort(est.begin(), est.begin() + kTopk, est.end());
+        for (size_t k = 0; k < kTopk; ++k) {
+            hit += std::count(gt[q].begin(), gt[q].end(), est[k].second);
+        }
+    }
+
+    report.mean_rel = std::accumulate(rel_errors.begin(), rel_errors.end(), 0.0) /
+                      static_cast<double>(rel_errors.size());
+    auto p99 = rel_errors.begin() + static_cast<long>(rel_errors.size() * 99 / 100);
+    std::nth_element(rel_errors.begin(), p99, rel_errors.end());
+    report.p99_rel = *p99;
+    report.recall = static_cast<double>(hit) / static_cast<double>(num_query * kTopk);
+
+    delete rotator;
+    return report;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <arg1> <arg2> <arg3> <arg4>\n"
+                  << "arg1: path for data file, format .fvecs\n"
+                  << "arg2: total number of bits for quantization, 1 by default\n"
+                  << "arg3: num of sampled data vectors, 10000 by default\n"
+                  << "arg4: num of sampled queries (from data), 200 by default\n";
+        exit(1);
+    }
+
+    char* data_file = argv[1];
+    size_t total_bits = argc > 2 ? atoi(argv[2]) : 1;
+    size_t num_sample = argc > 3 ? atoi(argv[3]) : 10000;
+    size_t num_query = argc > 4 ? atoi(argv[4]) : 200;
+
+    data_type data;
+    rabitqlib::load_vecs<float, data_type>(data_file, data);
+    size_t dim = data.cols();
+    num_sample = std::min(num_sample, static_cast<size_t>(data.rows()) / 2);
+    num_query = std::min(num_query, static_cast<size_t>(data.rows()) - num_sample);
+    if (total_bits < 1 || total_bits > 8 || num_sample < kTopk || num_query == 0) {
+        std::cerr << "Invalid total bits or not enough data\n";
+        exit(1);
+    }
+
+    // disjoint random samples of data vectors and queries
+    std::vector<size_t> ids(data.rows());
+    std::iota(ids.begin(), ids.end(), 0);
+    std::mt19937 gen(42);
+    std::shuffle(ids.begin(), ids.end(), gen);
+    std::vector<float> sample(num_sample * dim);
+    std::vector<float> queries(num_query * dim);
+    for (size_t i = 0; i < num_sample; ++i) {
+        std::copy_n(&data(ids[i], 0), dim, &sample[i * dim]);
+    }
+    for (size_t i = 0; i < num_query; ++i) {
+        std::copy_n(&data(ids[num_sample + i], 0), dim, &queries[i * dim]);
+    }
+
+    // exact top-k of queries in the sample
+    std::vector<std::vector<uint32_t>> gt(num_query);
+#pragma omp parallel for
+    for (size_t q = 0; q < num_query; ++q) {
+        std::vector<std::pair<float, uint32_t>> dist(num_sample);
+        for (size_t i = 0; i < num_sample; ++i) {
+            dist[i] = {
+                rabitqlib::euclidean_sqr(&queries[q * dim], &sample[i * dim], dim),
+                static_cast<uint32_t>(i)
+            };
+        }
+        std::partial_sort(dist.begin(), dist.begin() + kTopk, dist.end());
+        for (size_t k = 0; k < kTopk; ++k) {
+            gt[q].push_back(dist[k].second);
+        }
+    }
+
+    std::vector<std::pair<const char*, rabitqlib::RotatorType>> types = {
+        {"FhtKacRotator", rabitqlib::RotatorType::FhtKacRotator},
+        {"FhtKac2Rotator", rabitqlib::RotatorType::FhtKac2Rotator},
+        {"FhtKac1Rotator", rabitqlib::RotatorType::FhtKac1Rotator},
+        {"MatrixRotator", rabitqlib::RotatorType::MatrixRotator},
+    };
+    std::vector<Report> reports;
+    for (auto [name, type] : types) {
+        reports.push_back(evaluate(
+            name, type, sample.data(), num_sample, queries.data(), num_query, dim, total_bits,
+            gt
+        ));
+    }
+
+    // errors are also reported relative to the full FhtKacRotator
+    const Report& full = reports.front();
+    std::cout << "\nDIM " << dim << ", total bits " << total_bits << ", " << num_sample
+              << " data vectors, " << num_query << " queries\n";
+    std::cout << std::left << std::setw(16) << "rotator" << std::setw(14) << "rotate(us)"
+              << std::setw(14) << "mean rel err" << std::setw(14) << "p99 rel err"
+              << std::setw(12) << "vs full" << "recall@" << kTopk << '\n';
+    for (const auto& report : reports) {
+        std::cout << std::left << std::setw(16) << report.name << std::setw(14)
+                  << report.rotate_us << std::setw(14) << report.mean_rel << std::setw(14)
+                  << report.p99_rel << std::setw(12) << report.mean_rel / full.mean_rel
+                  << report.recall << '\n';
+    }
+
+    return 0;
+}
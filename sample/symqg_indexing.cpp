@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string>
 
 #include "defines.hpp"
 #include "index/symqg/qg.hpp"
@@ -12,12 +13,13 @@ using data_type = rabitqlib::RowMajorArray<float>;
 using gt_type = rabitqlib::RowMajorArray<uint32_t>;
 
 int main(int argc, char** argv) {
-    if (argc != 5) {
-        std::cerr << "Usage: " << argv[0] << " <arg1> <arg2> <arg3> <arg4>\n"
+    if (argc < 5) {
+        std::cerr << "Usage: " << argv[0] << " <arg1> <arg2> <arg3> <arg4> <arg5>\n"
                   << "arg1: path for data file, format .fvecs\n"
                   << "arg2: degree bound for symqg, must be a multiple of 32\n"
                   << "arg3: ef for indexing \n"
-                  << "arg4: path for saving index\n";
+                  << "arg4: path for saving index\n"
+                  << "arg5: metric type (\"l2\" or \"ip\")\n";
         exit(1);
     }
 
@@ -26,13 +28,28 @@ int main(int argc, char** argv) {
     size_t ef = atoi(argv[3]);
     char* index_file = argv[4];
 
+    rabitqlib::MetricType metric_type = rabitqlib::METRIC_L2;
+    if (argc > 5) {
+        std::string metric_str(argv[5]);
+        if (metric_str == "ip" || metric_str == "IP") {
+            metric_type = rabitqlib::METRIC_IP;
+        }
+    }
+    if (metric_type == rabitqlib::METRIC_IP) {
+        std::cout << "Metric Type: IP\n";
+    } else if (metric_type == rabitqlib::METRIC_L2) {
+        std::cout << "Metric Type: L2\n";
+    }
+
     data_type data;
 
     rabitqlib::load_vecs<float, data_type>(data_file, data);
 
     rabitqlib::StopW stopw;
 
-    index_type qg(data.rows(), data.cols(), degree);
+    index_type qg(
+        data.rows(), data.cols(), degree, rabitqlib::RotatorType::FhtKacRotator, metric_type
+    );
 
     rabitqlib::symqg::QGBuilder builder(qg, ef, data.data());
 